@@ -0,0 +1,76 @@
+#!/usr/bin/env ruby
+
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+#
+# This script compares the plain (@chords) and packed (@packed_chords) chord encodings of a collection:
+# it prints bytes per note of both encodings and scan throughput of ShiftOrAnd and MonoPoly on both.
+#
+# Usage: chordstats.rb [--patterns n] <songsfile or collection directory>
+
+require_relative '../lib/songcollection'
+require_relative '../lib/note'
+require_relative '../lib/chord'
+
+patterns = 20
+if (i = ARGV.index('--patterns')) then patterns = ARGV.delete_at(i + 1).to_i; ARGV.delete_at(i) end
+
+# Returns a pattern of the highest notes of len chords of a song, starting at a random chord.
+def random_pattern(song, len)
+	first = rand(song.num_chords - len)
+	song.get_matched_chords(first, first + len - 1).collect do |chord|
+		c = MIR::Chord.new(chord[0][0])
+		note = chord.max_by { |n| n[1] }
+		c.add(MIR::Note.new(note[1], note[2], 0))
+		c
+	end
+end
+
+# Scans the collection with each pattern and returns [seconds, number of matches].
+def scan(collection, algorithm, patterns)
+	start = Time.now
+	matches = 0
+	patterns.each do |pattern|
+		init_info = MIR::InitInfo.new(pattern)
+		init_info.checkingfunction = 0
+		init_info.matches = []
+		init_info.errors = init_info.gap = init_info.songonce = 0
+		init_info.textpattern = ""
+		MIR::Song.send("init_" + algorithm, init_info)
+		collection.search(algorithm, nil, init_info)
+		matches += init_info.matches.size
+	end
+	[Time.now - start, matches]
+end
+
+if ARGV.size != 1 then puts "Usage: chordstats.rb [--patterns n] <songsfile or collection directory>"
+else
+	c = MIR::SongCollection.new
+	if File.directory?(ARGV[0]) then c.load_segments(ARGV[0]) else c.load(ARGV[0].sub(/\.songs$/, '')) end
+	songs = (0...c.songs).collect { |i| c.get_song(i) }
+	songs.each do |song| song.unpack_chords end
+
+	srand(1)
+	candidates = songs.select { |song| song.num_chords > 20 }
+	pattern_list = (0...patterns).collect { random_pattern(candidates[rand(candidates.size)], 6) }
+	notes = c.notes[0] + c.songs	# including the pseudo-infinity notes
+	chords = c.chords
+
+	results = {}
+	[:plain, :packed].each do |encoding|
+		songs.each do |song| song.pack_chords end if encoding == :packed
+		bytes = songs.inject(0) { |sum, song| sum + song.instance_variable_get(encoding == :plain ? :@chords : :@packed_chords).bytesize }
+		line = "#{encoding}: #{bytes} bytes, #{format('%.2f', bytes.to_f / notes)} bytes/note"
+		["shiftorand", "monopoly"].each do |algorithm|
+			time, matches = scan(c, algorithm, pattern_list)
+			results[[algorithm, encoding]] = matches
+			line << ", #{algorithm} #{format('%.1f', chords * patterns / time / 1e6)} M chords/s (#{matches} matches)"
+		end
+		puts line
+	end
+	["shiftorand", "monopoly"].each do |algorithm|
+		puts "Error: #{algorithm} results differ" if results[[algorithm, :plain]] != results[[algorithm, :packed]]
+	end
+end
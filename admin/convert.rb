@@ -10,22 +10,32 @@
 # This script takes a directory of MIDI files as an argument and creates a .songs file,
 # that contains musical data from the MIDI files in a converted form.
 #
-# Usage: convert.rb <mididir>
+# Usage: convert.rb [--ruby] [--jobs n] [--packed] <mididir>
+#
+# MIDI files are read with the native converter; option --ruby uses the Ruby SMF library instead.
+# Files are converted in n parallel processes (default: number of processors). The resulting file
+# does not depend on the number of processes. With --packed, chord data is stored in the packed encoding
+# that takes less memory (see admin/chordstats.rb).
 
+require 'etc'
 require_relative '../lib/songcollection'
 
+native = ARGV.delete('--ruby').nil?
+packed = !ARGV.delete('--packed').nil?
+jobs = Etc.nprocessors
+if (i = ARGV.index('--jobs')) then jobs = ARGV.delete_at(i + 1).to_i; ARGV.delete_at(i) end
+
 # This script takes a directory of MIDI files as an argument and creates a songs file. 
-if ARGV.size != 1 then puts "Usage: convert.rb <mididir>"
+if ARGV.size != 1 then puts "Usage: convert.rb [--ruby] [--jobs n] [--packed] <mididir>"
 else 
 	mididir = ARGV[0]
 	if File.directory?(mididir) then
 		r = MIR::SongCollection.new
-		start = Time.new
-		r.convert_midifiles(mididir)
-		elapsed = Time.new - start
+		r.convert_midifiles(mididir, native, [jobs, 1].max)
+		r.pack_chords if packed
+		puts "#{r.songs} songs, #{r.distinct_songs} distinct; duplicates are scanned once and stored once."
 		# save to current directory
 		r.save(mididir.sub('.*\/([\w\d_\-]+)$','\1'))
-		puts "Conversion time: #{elapsed}"
 	else
 		puts "Note: to convert files, you must select a directory containing MIDI files, not a single file."
 	end
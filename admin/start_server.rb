@@ -9,8 +9,10 @@
 #
 # Contacts: turkia at cs helsinki fi
 # 
-# Usage: admin/start_server.rb
+# Usage: admin/start_server.rb [address]
+#
+# The address is host:port or unix:path; see MIR::Protocol::DEFAULT_ADDRESS.
 
 require_relative '../lib/server'
 
-MIR::Server.new('songs')
+MIR::Server.new('songs', MIR::AuxStore::DEFAULT_BUDGET, ARGV[0] || MIR::Protocol::DEFAULT_ADDRESS)
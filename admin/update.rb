@@ -0,0 +1,38 @@
+#!/usr/bin/env ruby
+
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+#
+# This script updates a segmented collection (a .collection directory) from a directory of MIDI files.
+# Only new and changed files are converted, into a new segment; deleted files are marked with tombstones.
+# A running server loads the changes without restart.
+#
+# Usage: update.rb [--ruby] [--jobs n] [--compact n] [--packed] <mididir> [<collection>]
+#
+# The collection defaults to <mididir>.collection in the current directory. With --compact, segments that have
+# tombstones or fewer than n songs are merged after the update (the server also does this in the background).
+# With --packed, chord data of the new songs is stored in the packed encoding.
+
+require 'etc'
+require_relative '../lib/songcollection'
+
+native = ARGV.delete('--ruby').nil?
+packed = !ARGV.delete('--packed').nil?
+jobs = Etc.nprocessors
+if (i = ARGV.index('--jobs')) then jobs = ARGV.delete_at(i + 1).to_i; ARGV.delete_at(i) end
+compact = nil
+if (i = ARGV.index('--compact')) then compact = ARGV.delete_at(i + 1).to_i; ARGV.delete_at(i) end
+
+if ARGV.size < 1 or ARGV.size > 2 then puts "Usage: update.rb [--ruby] [--jobs n] [--compact n] [--packed] <mididir> [<collection>]"
+else
+	mididir = ARGV[0]
+	if File.directory?(mididir) then
+		dir = ARGV[1] || mididir.sub(/\/+$/, '').sub(/.*\//, '') + ".collection"
+		MIR::SongCollection.new.update_segments(dir, mididir, native, [jobs, 1].max, packed)
+		if compact then puts "Merged #{MIR::SongCollection.compact_segments(dir, compact)} segments." end
+	else
+		puts "Note: to update a collection, you must select a directory containing MIDI files, not a single file."
+	end
+end
@@ -51,6 +51,11 @@ Headers = "<?xml version='1.0' encoding='UTF-8'?><!DOCTYPE html PUBLIC '-//W3C//
 
 Footer = "<br /><br /></body></html>"
 
+# Content types of the result formats of Client. Pages in other formats than HTML are sent as is, with the cursor of
+# the results, the number of matches listed, and whether the search stopped at its deadline and the fraction of songs
+# it searched in headers.
+Format_types = { 'html' => 'text/html', 'json' => 'application/json', 'binary' => 'application/octet-stream' }
+
 
 def with_headers(s); "#{Headers}\n#{s}\n#{Footer}"; end
 
@@ -67,32 +72,66 @@ def with_time
 	[yield, Time.new - start]
 end
 
+# Returns links to the previous and next pages of search results.
+def page_links(cursor, offset, count, total)
+	links = []
+	links << "<a href='page?cursor=#{cursor}&offset=#{[offset - count, 0].max}&count=#{count}'>Previous #{count}</a>" if offset > 0
+	links << "<a href='page?cursor=#{cursor}&offset=#{offset + count}&count=#{count}'>Next #{[count, total - offset - count].min}</a>" if offset + count < total
+	links.empty? ? "" : "Matches #{offset + 1}-#{[offset + count, total].min} of #{total}. #{links.join(' ')}<br />"
+end
+
 
 client = MIR::Client.new
 
 
 get '/matches' do
 	with_exception_wrapper {
+		count = (params[:count] || MIR::Page_size).to_i
+		count = MIR::Page_size if not (1..1000).include?(count)
+		format = Format_types[params[:format]] ? params[:format] : 'html'
+		timeout = params[:timeout] ? params[:timeout].to_f : nil
 		temp = with_time {	
 			client.search(params[:algorithm], params[:notepattern], params[:limit].to_i, 
 				      params[:songonce].to_i, params[:sort].to_i, params[:errors].to_i, 
-				      params[:gap].to_i, params[:textpattern])
+				      params[:gap].to_i, params[:textpattern], count, format, timeout)
 		}
 		results = temp[0]
 
 		# search results are converted to html by server. results[3] contains a result table in html form.
 		# here we add just headers and statistics.
-		if results then 
+		if results and format != 'html' then
+			content_type Format_types[format]
+			headers 'X-Result-Cursor' => results[7].to_s, 'X-Result-Count' => results[8].to_s,
+				'X-Result-Partial' => results[9].to_s, 'X-Result-Coverage' => results[10].to_s
+			results[4]
+		elsif results then 
 			with_headers("Results: #{results[2]} matches in " +
-			"#{results[3]} songs.<br>#{results[4]}<br />" +
+			"#{results[3]} songs.<br>#{results[4]}<br />" + page_links(results[7], 0, count, results[8]) +
 			"Pattern: #{params[:notepattern]}<br>Algorithm: #{params[:algorithm]}<br>" +
-			"Search time: #{temp[1]} (Total elapsed time on server side)")
+			"Search time: #{temp[1]} (Total elapsed time on server side)<br>" +
+			"#{results[5]}<br />#{results[6]}")
 		else 
 			with_headers "Server error."
 		end
 	}
 end
 
+get '/page' do
+	with_exception_wrapper {
+		offset = params[:offset].to_i
+		count = (params[:count] || MIR::Page_size).to_i
+		format = Format_types[params[:format]] ? params[:format] : 'html'
+		html, total = client.get_page(params[:cursor], offset, count, format)
+		if format != 'html' then
+			content_type Format_types[format]
+			headers 'X-Result-Count' => total.to_s
+			html
+		else
+			with_headers "#{html}<br />#{page_links(params[:cursor], offset, count, total)}"
+		end
+	}
+end
+
 get '/similarities' do
 	with_exception_wrapper {
 		with_headers "Similarities for file #{params[:filepath]}:<br /><br />#{client.get_similarities(params[:filepath])}"
@@ -0,0 +1,210 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+require 'monitor'
+require 'digest'
+
+module MIR
+
+# Storage for auxiliary data of songs that only some algorithms need, such as track matrices and MonoPoly 
+# preprocessing. SongCollection#save writes the data to a separate .aux file, one section for each group of 
+# instance variables below, and SongCollection#load leaves it on disk. A section of a song is read when an algorithm 
+# or a Song method first needs it. Loaded sections are kept in least recently used order, and the oldest ones 
+# are evicted when their total size exceeds AuxStore.budget. Sections in use by with_sections are pinned and not
+# evicted; files are read and blocks run outside the lock of the store, so that concurrent searches do not wait
+# for each other.
+#
+# File format: "MIRAUX1\n", then a marshalled array of instance variable values for each section of each song, 
+# then a marshalled index { section => [[offset, length] for each song] }, and the 8-byte offset of the index.
+class AuxStore
+
+	# Instance variables of Song in each section.
+	SECTIONS = {
+		"tracks" => [:@tracks, :@compacted_tracks, :@compacted_mappings, :@compacted_offsets, :@track_aliases],
+		"monopoly" => [:@preprocessed, :@pitchsets],
+		"p3" => [:@preprocessed_p3_startpoints, :@preprocessed_p3_endpoints],
+		"primes" => [:@primes],
+		"metatext" => [:@metatext]
+	}
+
+	# Sections read by scan functions of algorithms; other algorithms use only @chords.
+	ALGORITHM_SECTIONS = {
+		"monopoly" => ["monopoly"], "intervalmatching" => ["monopoly"], "splitting" => ["monopoly", "tracks"],
+		"lcts" => ["tracks"], "dynprog" => ["tracks"], "dynprog_bp" => ["tracks"], "geometric_p3" => ["p3"]
+	}
+
+	MAGIC = "MIRAUX1\n"
+
+	# Default maximum total size in bytes of loaded sections.
+	DEFAULT_BUDGET = 512 * 1024 * 1024
+
+	@@budget = DEFAULT_BUDGET
+	@@resident = 0
+	@@loads = 0
+	@@evictions = 0
+	@@lru = {}				# [song, section] => size in bytes, least recently used first
+	@@pins = {}				# [song, section] => number of with_sections calls using the section
+	# song => [store, index of song in store]; values of a WeakMap would be collected, so a WeakKeyMap is needed
+	@@stores = defined?(ObjectSpace::WeakKeyMap) ? ObjectSpace::WeakKeyMap.new : {}.compare_by_identity
+	@@monitor = Monitor.new
+
+	# Maximum total size in bytes of loaded sections. Pinned sections may exceed it temporarily.
+	def AuxStore.budget
+		@@budget
+	end
+
+	def AuxStore.budget=(bytes)
+		@@monitor.synchronize do @@budget = bytes; evict end
+	end
+
+	# Returns a hash with the size of loaded sections, their number, and counts of loads and evictions.
+	def AuxStore.stats
+		@@monitor.synchronize do { "resident" => @@resident, "sections" => @@lru.size, "loads" => @@loads, "evictions" => @@evictions } end
+	end
+
+	# Writes the sections of given songs to a file. Songs may themselves have been loaded from an .aux file, 
+	# even from the same file, which is replaced only after writing. Identical sections (e.g. of duplicate songs) 
+	# are written once and shared in the index.
+	def AuxStore.write(filename, songs)
+		File.open(filename + ".tmp", "wb") do |file|
+			file.write(MAGIC)
+			index = {}
+			written = {}
+			SECTIONS.each do |section, ivars|
+				index[section] = songs.collect do |song|
+					data = with_sections(song, [section]) { Marshal.dump(ivars.collect { |ivar| song.instance_variable_get(ivar) }) }
+					written[Digest::SHA256.digest(data)] ||= begin
+						offset = file.pos
+						file.write(data)
+						[offset, data.bytesize]
+					end
+				end
+			end
+			offset = file.pos
+			Marshal.dump(index, file)
+			file.write([offset].pack("Q"))
+		end
+		File.rename(filename + ".tmp", filename)
+	end
+
+	# Returns a copy of a song without the instance variables stored by write.
+	def AuxStore.strip(song)
+		copy = song.dup
+		SECTIONS.each_value do |ivars| ivars.each do |ivar| copy.remove_instance_variable(ivar) if copy.instance_variable_defined?(ivar) end end
+		copy
+	end
+
+	# Opens an .aux file and attaches its sections to given songs, which must be in the order they were written.
+	def initialize(filename, songs)
+		@file = File.open(filename, "rb")
+		raise "#{filename}: not an auxiliary data file" if @file.read(MAGIC.bytesize) != MAGIC
+		@file.seek(-8, IO::SEEK_END)
+		@file.seek(@file.read(8).unpack1("Q"))
+		@index = Marshal.load(@file)
+		songs.each_with_index do |song, i| @@stores[song] = [self, i] end
+	end
+
+	# Calls the block with the given sections of given songs (a song or an array of songs) loaded.
+	# Sections are pinned while the block runs, so that C functions may use them.
+	def AuxStore.with_sections(songs, sections)
+		songs = [songs] if not songs.is_a?(Array)
+		return yield if sections.empty?
+		keys = pin(songs, sections)
+		begin
+			yield
+		ensure
+			unpin(keys)
+		end
+	end
+
+	# Loads a section of a song if it is stored in an .aux file and not loaded, and marks it recently used.
+	# Other sections may be evicted. Returns true if the song has an .aux file.
+	def AuxStore.load(song, section)
+		keys = pin([song], [section])
+		unpin(keys, keys)
+		not keys.empty?
+	end
+
+	# Pins the sections of songs that have an .aux file, loads those that are not loaded, and marks them recently 
+	# used. Returns the keys of the pinned sections for unpin.
+	def AuxStore.pin(songs, sections)
+		keys = []
+		cold = []
+		@@monitor.synchronize do
+			songs.each do |song|
+				store, i = @@stores[song]
+				next if not store
+				sections.each do |section|
+					key = [song, section]
+					keys.push(key)
+					@@pins[key] = (@@pins[key] || 0) + 1
+					if (size = @@lru.delete(key)) then @@lru[key] = size else cold.push([key, store, i]) end
+				end
+			end
+		end
+		return keys if cold.empty?
+
+		# sections not loaded are read without the lock; if another thread loaded a section meanwhile, it is kept
+		begin
+			values = cold.collect { |key, store, i| store.read(i, key[1]) }
+		rescue Exception
+			unpin(keys)
+			raise
+		end
+		@@monitor.synchronize do
+			cold.each_with_index do |(key, store, i), k|
+				if (size = @@lru.delete(key)) then @@lru[key] = size; next end
+				@@lru[key] = size = assign(key[0], key[1], values[k])
+				@@resident += size
+				@@loads += 1
+			end
+			evict
+		end
+		keys
+	end
+	private_class_method :pin
+
+	# Releases sections pinned by pin, and evicts sections other than those in keep if they no longer fit to the budget.
+	def AuxStore.unpin(keys, keep = [])
+		return if keys.empty?
+		@@monitor.synchronize do
+			keys.each do |key| if (@@pins[key] -= 1) == 0 then @@pins.delete(key) end end
+			evict(keep)
+		end
+	end
+	private_class_method :unpin
+
+	# Sets instance variables of a section of a song to given values. Returns the size of the section in bytes.
+	def AuxStore.assign(song, section, values)
+		size = 0
+		SECTIONS[section].each_with_index do |ivar, k|
+			song.instance_variable_set(ivar, values[k])
+			size += values[k].is_a?(String) ? values[k].bytesize : (values[k].is_a?(Array) ? values[k].size * 8 : 8)
+		end
+		size
+	end
+	private_class_method :assign
+
+	# Evicts least recently used sections until the loaded sections fit to the budget. Pinned sections and those in
+	# keep are not evicted.
+	def AuxStore.evict(keep = [])
+		@@lru.each_key do |key|
+			break if @@resident <= @@budget
+			next if @@pins[key] or keep.include?(key)
+			SECTIONS[key[1]].each do |ivar| key[0].instance_variable_set(ivar, nil) end
+			@@resident -= @@lru.delete(key)
+			@@evictions += 1
+		end
+	end
+	private_class_method :evict
+
+	# Returns the instance variable values of a section of song i.
+	def read(i, section)
+		offset, length = @index[section][i]
+		Marshal.load(@file.pread(length, offset))
+	end
+end
+
+end	# module
@@ -6,11 +6,10 @@
 #
 # Copyright Mika Turkia
 
-require 'drb'
-
 require_relative './note.rb'
 require_relative './chord.rb'
 require_relative './midiutils.rb'
+require_relative './protocol.rb'
 
 module MIR
 
@@ -29,26 +28,31 @@ Gap_error = "maximum gap between notes must be between zero and 10."
 # MIDI division.
 Quarternotelength = 960
 
+# Number of results on a page.
+Page_size = 50
+
+# Formats of pages of results (see Server::FORMATS).
+Formats = ['html', 'json', 'binary']
+
 
 # Client class that implements methods used by http_server.rb.
 # As a rule, server returns a HTML string (2013 note: impractical but refactoring this is too much work since html conversion is implemented in the C extension.)
+# Requests are sent with the binary protocol of Protocol over one connection, which threads may share.
 class Client
 
-	# Creates a new client.
-	def initialize
-		begin
-			DRb.start_service()
-			@server = DRbObject.new(nil, 'druby://localhost:9822')
-		rescue => e
-			"server is not running. Try 'admin/start_server.rb' and 'admin/start_server.rb'.<br /></body></html>"
-		end
+	# Creates a new client of the server at an address (see Protocol::DEFAULT_ADDRESS). The server is connected on the first request.
+	def initialize(address = Protocol::DEFAULT_ADDRESS)
+		@server = Protocol::Connection.new(address)
 	end
 
 	# Default error message.
 	Error = "Error: Could not find MIDI file."
 
 	# Main search method. Checks parameter values and converts note pattern string to an array of Chord objects that contain Note objects.
-	def search(algorithm, notepattern, limit, songonce = 0, sort = 2, errors = 0, gap = 0, textpattern = '')
+	# The results contain the first page of matches as HTML, or in another format of Formats, and a cursor for reading 
+	# further pages with get_page. A search stops after timeout seconds, or the default time of the server if timeout is
+	# nil, and then returns the matches found until then.
+	def search(algorithm, notepattern, limit, songonce = 0, sort = 2, errors = 0, gap = 0, textpattern = '', count = Page_size, format = 'html', timeout = nil)
 
 		algorithm = 'monopoly' if not (3..30).include?(algorithm.size)
 		textpattern ||= ''
@@ -59,6 +63,9 @@ class Client
 		raise Gap_error if not (0..10).include?(gap)
 
 		if limit <= 0 or limit > 1000 then limit = 1000 end
+		count = Page_size if not (1..1000).include?(count)
+		format = 'html' if not Formats.include?(format)
+		timeout = nil if not timeout.is_a?(Numeric) or timeout <= 0
 		if sort < 0 or sort > 10 then sort = 0 end
 		songonce = 1 if not [0, 1].include?(songonce) 
 
@@ -96,7 +103,20 @@ class Client
 		end
 
 		# search results are converted to html by server. results[3] contains a result table in html form. 
-		@server.search(algorithm, pattern, limit, songonce, sort, errors, gap, textpattern)
+		@server.call(Protocol::SEARCH, algorithm, Protocol.pattern_value(pattern), limit, songonce, sort, errors, gap, textpattern, count, format, timeout)
+	end
+
+	# Returns a page of count matches starting from offset of the results of a search, as a HTML string or in another 
+	# format of Formats, and the number of matches in the results.
+	def get_page(cursor, offset, count = Page_size, format = 'html')
+		raise "invalid result cursor." if not cursor =~ /\A\h{16}\z/
+		offset = offset.to_i
+		count = count.to_i
+		raise "invalid page." if not (0..1000).include?(offset) or not (1..1000).include?(count)
+		raise "invalid result format." if not Formats.include?(format)
+		page = @server.call(Protocol::PAGE, cursor, offset, count, format)
+		raise "results have expired; please search again." if page.nil?
+		page
 	end
 
 	# Returns MIDI file containing matched part of a song. File may then be played on client computer.
@@ -111,7 +131,7 @@ class Client
 		if firstchord < 0 or lastchord <= 0 or lastchord - firstchord <= 0 or firstchord > 999999 or lastchord > 999999 then error end
 
 		# get reference to song instance 
-		midi = @server.generate_midi(filepath, firstchord, lastchord)
+		midi = @server.call(Protocol::GENERATE_MIDI, filepath, firstchord, lastchord)
 		raise Error if midi.nil?
 
 		# return midi file
@@ -121,7 +141,7 @@ class Client
 	# Returns HTML string containing various histograms of song's note data.
 	def get_histograms(filepath)
 		_check_filepath_param(filepath)
-		hist = @server.get_histogram(filepath)
+		hist = @server.call(Protocol::GET_HISTOGRAM, filepath)
 		raise 'Histogram generation failed.' if hist.nil?
 		hist
 	end
@@ -130,7 +150,7 @@ class Client
 	def get_similarities(filepath)
 		raise Error if filepath.nil? or filepath.size > 250
 		# get similarities array: [rank, song metadata] 
-		s = @server.get_similarities(filepath)
+		s = @server.call(Protocol::GET_SIMILARITIES, filepath)
 		raise Error if s.nil?
 		s
 	end
@@ -6,11 +6,12 @@
 
    Copyright Mika Turkia
 
-   C language function for converting matches to HTML.
+   C language functions for converting matches to HTML, JSON and a binary format.
 */
 
 
 #include <ruby.h>
+#include <ruby/encoding.h>
 #include <string.h>
 #include <math.h>
 #include "../csong/song.h"
@@ -21,245 +22,473 @@
 /* definitions specific to result processing */
 #define ALIGNMAXLEN 512
 #define NOTEMAXLEN 256 
-#define ROWMAXLEN 2048
+
+/* appends a string literal to a Ruby string */
+#define CAT(s, lit) rb_str_buf_cat((s), (lit), sizeof(lit) - 1)
 
 
 VALUE cServer;
 VALUE cMIR;
 
+static const char *note_names[VOCSIZE] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+
+/* note names of alignment strings are padded to two characters */
+static const char *align_names[VOCSIZE] = { "C ", "C#", "D ", "D#", "E ", "F ", "F#", "G ", "G#", "A ", "A#", "B " };
+
+
+/*
+   Appends an integer in decimal to a Ruby string.
+*/
+static void cat_int(VALUE s, long n)
+{
+	char buf[24], *p = buf + sizeof(buf);
+	unsigned long u = n < 0 ? - (unsigned long) n : (unsigned long) n;
+
+	do { *--p = '0' + u % 10; u /= 10; } while (u);
+	if (n < 0) *--p = '-';
+	rb_str_buf_cat(s, p, buf + sizeof(buf) - p);
+}
+
+
+/*
+   Appends an unsigned integer of n bytes (at most 8) in big-endian order to a Ruby string.
+*/
+static void cat_be(VALUE s, unsigned long long u, int n)
+{
+	char buf[8];
+	int k;
+
+	for (k = n - 1; k >= 0; k--, u >>= 8) buf[k] = (char) (u & 0xff);
+	rb_str_buf_cat(s, buf, n);
+}
+
+
+/*
+   Appends a string as a JSON string literal. Control characters, quotes and backslashes are escaped; other bytes
+   are copied, so the string should be UTF-8.
+*/
+static void cat_json_string(VALUE s, const char *str, long len)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 'u', '0', '0', 0, 0 };
+	long j, start = 0;
+	unsigned char c;
+
+	CAT(s, "\"");
+	for (j = 0; j < len; j++)
+	{
+		c = (unsigned char) str[j];
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+		rb_str_buf_cat(s, str + start, j - start);
+		if (c == '"') CAT(s, "\\\"");
+		else if (c == '\\') CAT(s, "\\\\");
+		else { esc[4] = hex[c >> 4]; esc[5] = hex[c & 15]; rb_str_buf_cat(s, esc, 6); }
+		start = j + 1;
+	}
+	rb_str_buf_cat(s, str + start, len - start);
+	CAT(s, "\"");
+}
+
+
+/*
+   Appends an alignment string of lcts as a JSON array of pitches, with null for gaps.
+*/
+static void cat_json_align(VALUE s, const char *align)
+{
+	size_t j, len = strlen(align);
+
+	CAT(s, "[");
+	for (j = 0; j < len; j++)
+	{
+		if (j > 0) CAT(s, ",");
+		if (align[j] == GAP) CAT(s, "null");
+		else cat_int(s, align[j]);
+	}
+	CAT(s, "]");
+}
+
+
+/*
+   Returns the MIDI url of a song, which identifies it in requests, or an empty string.
+*/
+static VALUE song_id(VALUE song)
+{
+	VALUE url = rb_iv_get(song, "@midiurl");
+
+	return RB_TYPE_P(url, T_STRING) ? url : rb_str_new(NULL, 0);
+}
+
+
+/*
+   Appends an alignment string of lcts, of which stringlen characters of output have been used, as note names.
+   Returns the new length.
+*/
+static int cat_align(VALUE s, const char *align, int stringlen)
+{
+	size_t j, len = strlen(align);
+
+	for (j = 0; j < len && stringlen + 8 < ALIGNMAXLEN; j++, stringlen += 8)
+	{
+		if (align[j] == GAP) CAT(s, "- ");
+		else rb_str_buf_cat(s, align_names[(align[j] % VOCSIZE + VOCSIZE) % VOCSIZE], 2);
+		CAT(s, "&nbsp;");
+	}
+	return stringlen;
+}
+
+
 /*
-   Generates HTML string from result array.
+   Returns the bar number of time strt from the time signatures of a song, given as (start, nominator, denominator) 
+   triples. Later signatures are subtracted first; the float arithmetic is that of earlier versions.
 */
-static VALUE c_matches_to_html(VALUE self, VALUE matches)
+static unsigned int bar_number(unsigned int strt, unsigned int quarternoteduration, const unsigned int *sigs, long num_sigs)
 {
-	VALUE s, notes, match, song, transp_num, scoreurl_rb, timesignatures, timesig;
-	int transp, ptch, ti;
-	unsigned int i, len, j, firstchord, lastchord, notes_len, quarternoteduration, bar, strt, sigstrt;
-	char notestr[NOTEMAXLEN + 1], *nastr, *playstr, *t1, *name = NULL, *notestrp, scoreurl[256], pdfurl[256], *midiurl = NULL, *chords, *preprocessed;
-	char *align_p, *align_t, *alignstrp, alignstr[ALIGNMAXLEN + 1];
-	int stringlen = 0;
-	unsigned int nom, denom;
+	unsigned int bar = 1;
+	long ti;
 
-	char *rowstr = (char *) ALLOCA_N(char, ROWMAXLEN);
+	if (num_sigs == 0) return strt / (quarternoteduration * 4) + 1;
+	for (ti = num_sigs - 1; ti >= 0; ti--)
+	{
+		if (strt > sigs[3 * ti])
+		{
+			bar += (strt - sigs[3 * ti]) / (4 * quarternoteduration * ((float) sigs[3 * ti + 1] / sigs[3 * ti + 2]));
+			strt = sigs[3 * ti];
+		}
+	}
+	return bar;
+}
 
-	nastr = "n/a";
-	playstr = "(play)";
+
+/*
+   Returns a string of the bar numbers (unsigned ints) of the chords of a song, for the row fragments of 
+   Server#row_fragments.
+*/
+static VALUE c_chord_bars(VALUE self, VALUE song)
+{
+	volatile VALUE chords_str, sigs_str;
+	VALUE bars_str, timesignatures, timesig;
+	unsigned int i, num_chords, quarternoteduration, strt, *sigs, *bars;
+	long ti, num_sigs;
+	char *chords;
+
+	chords_str = rb_funcall(song, rb_intern("chords"), 0);
+	chords = RSTRING_PTR(chords_str);
+	num_chords = NUM2UINT(rb_iv_get(song, "@num_chords"));
+	quarternoteduration = NUM2UINT(rb_iv_get(song, "@quarternoteduration"));
+
+	timesignatures = rb_iv_get(song, "@timesignatures");
+	num_sigs = RARRAY_LEN(timesignatures);
+	sigs_str = rb_str_new(NULL, num_sigs * 3 * sizeof(unsigned int));
+	sigs = (unsigned int *) RSTRING_PTR(sigs_str);
+	for (ti = 0; ti < num_sigs; ti++)
+	{
+		timesig = RARRAY_PTR(timesignatures)[ti];
+		sigs[3 * ti] = NUM2UINT(RARRAY_PTR(timesig)[0]);
+		sigs[3 * ti + 1] = NUM2UINT(RARRAY_PTR(timesig)[1]);
+		sigs[3 * ti + 2] = (unsigned int) pow(2, NUM2UINT(RARRAY_PTR(timesig)[2]));
+	}
+
+	bars_str = rb_str_new(NULL, num_chords * sizeof(unsigned int));
+	bars = (unsigned int *) RSTRING_PTR(bars_str);
+	for (i = 0; i < num_chords; i++)
+	{
+		memcpy(&strt, chords + 1, sizeof(strt));
+		bars[i] = bar_number(strt, quarternoteduration, sigs, num_sigs);
+		chords += CHORDHEADERLEN + CHORDLEN(chords) * NOTELEN;
+	}
+	return bars_str;
+}
+
+
+/*
+   Generates HTML string from result array. Rows are numbered from offset + 1, so that a page of results
+   shows the positions of its matches in the whole result list.
+
+   Cells that depend only on the song, and the bar numbers of its chords, are taken from Server#row_fragments, 
+   which caches them. Rows are appended to the result string piece by piece.
+*/
+static VALUE c_matches_to_html(VALUE self, VALUE matches, VALUE offset)
+{
+	volatile VALUE chords_str = Qnil, fragments = Qnil;
+	VALUE s, notes, match, song, prevsong = Qnil, transp_num, bars_str;
+	long i, len, j, notes_len, row_offset;
+	unsigned int firstchord, lastchord;
+	int ptch, stringlen;
+	char *chords = NULL;
+	ID id_row_fragments = rb_intern("row_fragments"), id_chords = rb_intern("chords");
 
 	len = RARRAY_LEN(matches);
+	row_offset = NUM2LONG(offset);
 
 	/* create main result string with table start header and column headers */
-	s = rb_str_new2("<table><tr><td>Number</td><td>Composer</td><td>Title</td><td>Opus</td><td>Date</td><td>Style</td><td>Play</td><td>Metadata</td><td>Score&nbsp;&nbsp;&nbsp;&nbsp;</td><td>Appr.Bar #</td><td>Matched Notes</td><td>Transposition</td><td>Errors</td><td>Splits/Duration</td><td>Aligns</td></tr>");
-
+	s = rb_str_buf_new(len * 320 + 512);
+	CAT(s, "<table><tr><td>Number</td><td>Composer</td><td>Title</td><td>Opus</td><td>Date</td><td>Style</td><td>Play</td><td>Metadata</td><td>Score&nbsp;&nbsp;&nbsp;&nbsp;</td><td>Appr.Bar #</td><td>Matched Notes</td><td>Transposition</td><td>Errors</td><td>Splits/Duration</td><td>Aligns</td></tr>");
 
 	/* loop through all results */
 	for (i = 0; i < len; i++)
 	{
 		match = RARRAY_PTR(matches)[i];
 		song = RARRAY_PTR(match)[0];
-		chords = (char *) RSTRING_PTR(rb_iv_get(song, "@chords"));
+
+		/* matches of a song are usually consecutive */
+		if (song != prevsong)
+		{
+			fragments = rb_funcall(self, id_row_fragments, 1, song);
+			/* Song#chords decodes packed songs */
+			chords_str = rb_funcall(song, id_chords, 0);
+			chords = RSTRING_PTR(chords_str);
+			prevsong = song;
+		}
 		firstchord = NUM2UINT(RARRAY_PTR(match)[1]);
 		lastchord = NUM2UINT(RARRAY_PTR(match)[2]);
-		timesignatures = rb_iv_get(song, "@timesignatures");
 
-		transp_num = RARRAY_PTR(match)[4];
-		if (transp_num == Qnil) transp = 0; else transp = NUM2INT(transp_num);
+		CAT(s, "<tr><td>");
+		cat_int(s, row_offset + i + 1);
+		CAT(s, "</td>");
+		rb_str_buf_append(s, RARRAY_PTR(fragments)[0]);
 
-		scoreurl_rb = rb_iv_get(song, "@scoreurl");
-		if (scoreurl_rb == Qnil || RSTRING_LEN(scoreurl_rb) == 0)
+		/* approximate bar number of the start of the match */
+		CAT(s, "<td>");
+		bars_str = RARRAY_PTR(fragments)[2];
+		cat_int(s, (size_t) firstchord < RSTRING_LEN(bars_str) / sizeof(unsigned int) ? ((unsigned int *) RSTRING_PTR(bars_str))[firstchord] : 0);
+		CAT(s, "</td>");
+
+		rb_str_buf_append(s, RARRAY_PTR(fragments)[1]);
+		cat_int(s, firstchord);
+		CAT(s, "&lastchord=");
+		cat_int(s, lastchord);
+		CAT(s, "'>");
+
+		/* matched notes */
+		notes = RARRAY_PTR(match)[3];
+		notes_len = (notes != Qnil) ? RARRAY_LEN(notes) : 0;
+		for (j = 0, stringlen = 0; j < notes_len && stringlen + 7 < NOTEMAXLEN; j++)
 		{
-			scoreurl[0] = '\0';
-			pdfurl[0] = '\0';
+			ptch = (int) chords[NUM2SIZET(RARRAY_PTR(notes)[j])];
+
+			/* symbolic durations to be added */
+			rb_str_buf_cat2(s, note_names[ptch % VOCSIZE]);
+			cat_int(s, ptch / VOCSIZE);
+			CAT(s, " ");
+			stringlen += strlen(note_names[ptch % VOCSIZE]) + (ptch / VOCSIZE < 10 ? 2 : 3);
 		}
-		else 
+		if (notes_len == 0) CAT(s, "(play)");
+
+		transp_num = RARRAY_PTR(match)[4];
+		CAT(s, "</a></td><td>");
+		cat_int(s, transp_num == Qnil ? 0 : NUM2INT(transp_num));
+		CAT(s, "</td><td>");
+		cat_int(s, NUM2INT(RARRAY_PTR(match)[5]));
+		CAT(s, "</td><td>");
+		cat_int(s, RARRAY_LEN(match) == 7 ? NUM2INT(RARRAY_PTR(match)[6]) : 0);
+		CAT(s, "</td><td>");
+
+		/* align strings for lcts */
+		if (RARRAY_LEN(match) == 8)
 		{
-			snprintf(scoreurl, 254, "<a href='%s '>PS</a>", RSTRING_PTR(scoreurl_rb));
-			 /* pdf url is the same as ps url except last two letters are different. */
-			snprintf(pdfurl, 254, "<a href='%s '>PDF</a>", RSTRING_PTR(scoreurl_rb));
-			pdfurl[RSTRING_LEN(scoreurl_rb) + 8] = 'd';
-			pdfurl[RSTRING_LEN(scoreurl_rb) + 9] = 'f';
+			stringlen = cat_align(s, RSTRING_PTR(RARRAY_PTR(match)[6]), 0);
+			if (stringlen + 4 < ALIGNMAXLEN) CAT(s, "<br>");
+			cat_align(s, RSTRING_PTR(RARRAY_PTR(match)[7]), stringlen);
 		}
+		CAT(s, "</td><tr>\n");
+	}
 
-		notes = RARRAY_PTR(match)[3];
-		if (notes != Qnil) notes_len = (unsigned int) RARRAY_LEN(notes);
-		else notes_len = 0;
+	/* add table end header to main result string */
+	CAT(s, "</table>");
+
+	return s;
+}
 
-		/* midiurl can't be Qnil */
-		midiurl = (strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@midiurl"))) == 0) ? nastr : t1;
 
-		/* calculate bar number of the start of the match */
-		quarternoteduration = NUM2UINT(rb_iv_get(song, "@quarternoteduration"));
-		preprocessed = (char *) RSTRING_PTR(rb_iv_get(song, "@preprocessed"));
+/*
+   Generates a JSON array of the matches, for clients that do not want HTML. Each match is an object:
 
-		/* we need to get strt of the first chord, and we get the starting position of the chord */
-		/* from preprocessed data by indexing with firstchord */
-		strt = *((unsigned int *) (chords + *((unsigned int *) (preprocessed + firstchord * PP_ITEM_SIZE)) + 1));
-		if (RARRAY_LEN(timesignatures) == 0) bar = strt / (quarternoteduration * 4) + 1; 
-		else
+     {"number": row number (from offset + 1), "song": MIDI url of the song, "firstchord": .., "lastchord": ..,
+      "notes": byte offsets of the matched notes in the chords of the song, or null, "pitches": their pitches,
+      "transposition": .. or null, "errors": .., "splits": splits or duration, or null,
+      "alignment": [pattern pitches, text pitches] of lcts with null for gaps, or null}
+
+   The text is written directly from the match rows, without building Ruby objects for it.
+*/
+static VALUE c_matches_to_json(VALUE self, VALUE matches, VALUE offset)
+{
+	volatile VALUE chords_str = Qnil, id = Qnil;
+	VALUE s, notes, match, song, prevsong = Qnil, transp_num;
+	long i, len, j, notes_len, row_offset, chords_len = 0;
+	size_t pos;
+	char *chords = NULL;
+	ID id_chords = rb_intern("chords");
+
+	len = RARRAY_LEN(matches);
+	row_offset = NUM2LONG(offset);
+
+	s = rb_str_buf_new(len * 200 + 2);
+	CAT(s, "[");
+	for (i = 0; i < len; i++)
+	{
+		match = RARRAY_PTR(matches)[i];
+		song = RARRAY_PTR(match)[0];
+		if (song != prevsong)
 		{
-			bar = 1;
-			for (ti = RARRAY_LEN(timesignatures) - 1; ti >= 0; ti--)
-			{
-				timesig = RARRAY_PTR(timesignatures)[ti];
-				sigstrt = NUM2UINT(RARRAY_PTR(timesig)[0]);
+			id = song_id(song);
+			chords_str = rb_funcall(song, id_chords, 0);
+			chords = RSTRING_PTR(chords_str);
+			chords_len = RSTRING_LEN(chords_str);
+			prevsong = song;
+		}
 
-				if (strt > sigstrt)
-				{
-					nom = NUM2UINT(RARRAY_PTR(timesig)[1]);
-					denom =	(unsigned int) pow(2, NUM2UINT(RARRAY_PTR(timesig)[2]));
+		if (i > 0) CAT(s, ",\n");
+		CAT(s, "{\"number\":");
+		cat_int(s, row_offset + i + 1);
+		CAT(s, ",\"song\":");
+		cat_json_string(s, RSTRING_PTR(id), RSTRING_LEN(id));
+		CAT(s, ",\"firstchord\":");
+		cat_int(s, NUM2UINT(RARRAY_PTR(match)[1]));
+		CAT(s, ",\"lastchord\":");
+		cat_int(s, NUM2UINT(RARRAY_PTR(match)[2]));
 
-					bar += (strt - sigstrt) / (4 * quarternoteduration * ((float) nom / denom));
-					strt -= (strt - sigstrt);
-				}
+		notes = RARRAY_PTR(match)[3];
+		notes_len = (notes != Qnil) ? RARRAY_LEN(notes) : 0;
+		if (notes == Qnil) CAT(s, ",\"notes\":null,\"pitches\":null");
+		else
+		{
+			CAT(s, ",\"notes\":[");
+			for (j = 0; j < notes_len; j++)
+			{
+				if (j > 0) CAT(s, ",");
+				cat_int(s, (long) NUM2SIZET(RARRAY_PTR(notes)[j]));
 			}
+			CAT(s, "],\"pitches\":[");
+			for (j = 0; j < notes_len; j++)
+			{
+				if (j > 0) CAT(s, ",");
+				pos = NUM2SIZET(RARRAY_PTR(notes)[j]);
+				if (pos < (size_t) chords_len) cat_int(s, chords[pos]);
+				else CAT(s, "null");
+			}
+			CAT(s, "]");
 		}
 
+		transp_num = RARRAY_PTR(match)[4];
+		CAT(s, ",\"transposition\":");
+		if (transp_num == Qnil) CAT(s, "null");
+		else cat_int(s, NUM2INT(transp_num));
+		CAT(s, ",\"errors\":");
+		cat_int(s, NUM2INT(RARRAY_PTR(match)[5]));
+		CAT(s, ",\"splits\":");
+		if (RARRAY_LEN(match) == 7 && RARRAY_PTR(match)[6] != Qnil) cat_int(s, NUM2INT(RARRAY_PTR(match)[6]));
+		else CAT(s, "null");
+		CAT(s, ",\"alignment\":");
+		if (RARRAY_LEN(match) == 8)
+		{
+			CAT(s, "[");
+			cat_json_align(s, StringValueCStr(RARRAY_PTR(match)[6]));
+			CAT(s, ",");
+			cat_json_align(s, StringValueCStr(RARRAY_PTR(match)[7]));
+			CAT(s, "]");
+		}
+		else CAT(s, "null");
+		CAT(s, "}");
+	}
+	CAT(s, "]");
 
-		/* matched notes */
-		notestr[0] = '\0';
-		notestrp = notestr;
-		stringlen = 0;
+	rb_enc_associate(s, rb_utf8_encoding());
+	return s;
+}
 
-		for (j = 0; j < notes_len; j++)
-		{
-			ptch = (int) chords[NUM2INT(RARRAY_PTR(notes)[j])];
 
-			/* convert midi value to english note name. inlined to improve performance. */
-			switch (ptch % VOCSIZE)
-			{
-				case 0: name = "C"; break;
-				case 1: name = "C#"; break;
-				case 2: name = "D"; break;
-				case 3: name = "D#"; break;
-				case 4: name = "E"; break;
-				case 5: name = "F"; break;
-				case 6: name = "F#"; break;
-				case 7: name = "G"; break;
-				case 8: name = "G#"; break;
-				case 9: name = "A"; break;
-				case 10: name = "A#"; break;
-				case 11: name = "B"; break;
-			}
+/*
+   Generates a compact binary encoding of the matches. Integers are big-endian, as in Protocol.
 
-			/* symbolic durations to be added */
+     offset of the first match (u32), number of songs (u32), and for each song its MIDI url (u16 length and bytes);
+     number of matches (u32), and for each match:
+       index of its song in the song table (u32), first and last chord (u32), transposition (i32), errors (i32),
+       flags (u8): 1 transposition is present, 2 splits/duration follows, 4 alignment follows,
+       [splits or duration (i32)],
+       number of matched notes (u16), and for each its byte offset in the chords of the song (u64) and pitch (i8),
+       [alignment strings of the pattern and the text: u16 length and pitches (i8, -2 for gaps) each].
 
-			/* print to string */
-			if (stringlen + 7 < NOTEMAXLEN) snprintf(notestrp, 7, "%s%d ", name, ptch / VOCSIZE);
-			else break;
+   Songs are listed in the order of their first match. Rows are numbered from offset + 1, as in the other formats.
+*/
+static VALUE c_matches_to_binary(VALUE self, VALUE matches, VALUE offset)
+{
+	volatile VALUE chords_str = Qnil, songs, table, body;
+	VALUE s, notes, match, song, prevsong = Qnil, transp_num, index = Qnil, id, align;
+	long i, len, j, k, notes_len, chords_len = 0;
+	size_t pos, alen;
+	int flags;
+	char *chords = NULL;
+	ID id_chords = rb_intern("chords"), id_compare_by_identity = rb_intern("compare_by_identity");
 
-			if (ptch / VOCSIZE < 10)
-			{ 
-				notestrp += strlen(name) + 2;
-				stringlen += strlen(name) + 2;
-			}
-			else
-			{ 
-				notestrp += strlen(name) + 3;
-				stringlen += strlen(name) + 3;
-			}
-		}
+	len = RARRAY_LEN(matches);
 
+	/* song => index in the song table */
+	songs = rb_hash_new();
+	rb_funcall(songs, id_compare_by_identity, 0);
+	table = rb_str_buf_new(1024);
+	body = rb_str_buf_new(len * 48 + 4);
+	cat_be(body, len, 4);
 
-		/* align strings for lcts */
-		if (RARRAY_LEN(match) == 8)
+	for (i = 0; i < len; i++)
+	{
+		match = RARRAY_PTR(matches)[i];
+		song = RARRAY_PTR(match)[0];
+		if (song != prevsong)
 		{
-			stringlen = 0;
-			alignstrp = alignstr;
-			align_p =  RSTRING_PTR(RARRAY_PTR(match)[6]);
-			align_t =  RSTRING_PTR(RARRAY_PTR(match)[7]);
-
-			for (j = 0; j < strlen(align_p); j++)
+			index = rb_hash_lookup2(songs, song, Qnil);
+			if (index == Qnil)
 			{
-				if (align_p[j] == GAP) name = "- ";
-				else
-				{
-					switch (align_p[j] % VOCSIZE)
-					{
-						case 0: name = "C "; break;
-						case 1: name = "C#"; break;
-						case 2: name = "D "; break;
-						case 3: name = "D#"; break;
-						case 4: name = "E "; break;
-						case 5: name = "F "; break;
-						case 6: name = "F#"; break;
-						case 7: name = "G "; break;
-						case 8: name = "G#"; break;
-						case 9: name = "A "; break;
-						case 10: name = "A#"; break;
-						case 11: name = "B "; break;
-					}
-				}
-
-				if (stringlen + 8 < ALIGNMAXLEN)
-				{
-					snprintf(alignstrp, 9, "%s&nbsp;", name);
-					alignstrp += 8;
-					stringlen += 8;
-				}
-				else break;
+				index = LONG2NUM(RHASH_SIZE(songs));
+				rb_hash_aset(songs, song, index);
+				id = song_id(song);
+				alen = min2((size_t) RSTRING_LEN(id), 0xffff);
+				cat_be(table, alen, 2);
+				rb_str_buf_cat(table, RSTRING_PTR(id), alen);
 			}
+			chords_str = rb_funcall(song, id_chords, 0);
+			chords = RSTRING_PTR(chords_str);
+			chords_len = RSTRING_LEN(chords_str);
+			prevsong = song;
+		}
 
-			if (stringlen + 4 < ALIGNMAXLEN)
-			{ 
-				snprintf(alignstrp, 5, "<br> ");
-				alignstrp += 4;
-			}
+		transp_num = RARRAY_PTR(match)[4];
+		flags = (transp_num != Qnil ? 1 : 0) | (RARRAY_LEN(match) == 7 && RARRAY_PTR(match)[6] != Qnil ? 2 : 0) | 
+			(RARRAY_LEN(match) == 8 ? 4 : 0);
+		cat_be(body, NUM2ULONG(index), 4);
+		cat_be(body, NUM2UINT(RARRAY_PTR(match)[1]), 4);
+		cat_be(body, NUM2UINT(RARRAY_PTR(match)[2]), 4);
+		cat_be(body, (unsigned int) (transp_num != Qnil ? NUM2INT(transp_num) : 0), 4);
+		cat_be(body, (unsigned int) NUM2INT(RARRAY_PTR(match)[5]), 4);
+		cat_be(body, flags, 1);
+		if (flags & 2) cat_be(body, (unsigned int) NUM2INT(RARRAY_PTR(match)[6]), 4);
 
-			for (j = 0; j < strlen(align_t); j++)
+		notes = RARRAY_PTR(match)[3];
+		notes_len = (notes != Qnil) ? min2(RARRAY_LEN(notes), 0xffff) : 0;
+		cat_be(body, notes_len, 2);
+		for (j = 0; j < notes_len; j++)
+		{
+			pos = NUM2SIZET(RARRAY_PTR(notes)[j]);
+			cat_be(body, pos, 8);
+			cat_be(body, pos < (size_t) chords_len ? (unsigned char) chords[pos] : 0, 1);
+		}
+
+		if (flags & 4)
+		{
+			for (k = 6; k <= 7; k++)
 			{
-				if (align_t[j] == GAP) name = "- ";
-				else
-				{
-					switch (align_t[j] % VOCSIZE)
-					{
-						case 0: name = "C "; break;
-						case 1: name = "C#"; break;
-						case 2: name = "D "; break;
-						case 3: name = "D#"; break;
-						case 4: name = "E "; break;
-						case 5: name = "F "; break;
-						case 6: name = "F#"; break;
-						case 7: name = "G "; break;
-						case 8: name = "G#"; break;
-						case 9: name = "A "; break;
-						case 10: name = "A#"; break;
-						case 11: name = "B "; break;
-					}
-				}
-				if (stringlen + 8 < ALIGNMAXLEN)
-				{	
-					snprintf(alignstrp, 9, "%s&nbsp;", name);
-					alignstrp += 8;
-					stringlen += 8;
-				}
-				else break;
+				align = RARRAY_PTR(match)[k];
+				alen = min2(strlen(StringValueCStr(align)), 0xffff);
+				cat_be(body, alen, 2);
+				rb_str_buf_cat(body, RSTRING_PTR(align), alen);
 			}
-			alignstrp = "\0";
 		}
-
-
-		/* get values of other fields and print all */
-		snprintf(rowstr, ROWMAXLEN - 1, "<tr><td>%d</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td>%s</td><td><a href='%s'>MIDI</a></td><td><a href='histogram?filepath=%s'>Histogram</a></td><td>%s %s</td><td>%u</td><td><a href='midi?filepath=%s&firstchord=%u&lastchord=%u'>%s</a></td><td>%d</td><td>%ld</td><td>%ld</td><td>%s</td><tr>\n", \
-		i + 1, \
-		(strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@composer"))) == 0) ? nastr : t1, \
-		(strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@title"))) == 0) ? nastr : t1, \
-		(strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@opus"))) == 0) ? nastr : t1, \
-		(strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@date"))) == 0) ? nastr : t1, \
-		(strlen(t1 = RSTRING_PTR(rb_iv_get(song, "@style"))) == 0) ? nastr : t1, \
-		midiurl, midiurl, \
-		(strlen(scoreurl) == 0) ? nastr : scoreurl, \
-		(strlen(pdfurl) == 0) ? "" : pdfurl, \
-		bar, midiurl, firstchord, lastchord, \
-		(strlen(notestr) == 0) ? playstr : notestr, transp, (long) NUM2INT(RARRAY_PTR(match)[5]), \
-		(RARRAY_LEN(match) == 7) ? (long) NUM2INT(RARRAY_PTR(match)[6]): 0, \
-		(RARRAY_LEN(match) == 8) ? alignstr : "");
-
-		/* add this row to main result string */
-		rb_str_cat2(s, rowstr);
 	}
 
-	/* add table end header to main result string */
-	rb_str_concat(s, rb_str_new2("</table>"));
-
+	s = rb_str_buf_new(8 + RSTRING_LEN(table) + RSTRING_LEN(body));
+	cat_be(s, NUM2ULONG(offset), 4);
+	cat_be(s, RHASH_SIZE(songs), 4);
+	rb_str_buf_append(s, table);
+	rb_str_buf_append(s, body);
 	return s;
 }
 
@@ -273,5 +502,8 @@ void Init_Server()
 	cServer = rb_define_class_under(cMIR, "Server", rb_cObject);
 
 	/*rb_define_module_function(cServer, "matches_to_html", c_matches_to_html, 1);*/
-	rb_define_method(cServer, "matches_to_html", c_matches_to_html, 1);
+	rb_define_method(cServer, "matches_to_html", c_matches_to_html, 2);
+	rb_define_method(cServer, "matches_to_json", c_matches_to_json, 2);
+	rb_define_method(cServer, "matches_to_binary", c_matches_to_binary, 2);
+	rb_define_method(cServer, "chord_bars", c_chord_bars, 1);
 }
@@ -6,101 +6,309 @@
 
    Copyright Mika Turkia
 
-   Implements an equation (2) for calculating weighted edit distance 
-   from article Kjell Lemstrom and Gonzalo Navarro: Flexible and Efficient 
-   Bit-Parallel Techniques for Transposition Invariant Approximate Matching 
+   Implements an equation (2) for calculating weighted edit distance
+   from article Kjell Lemstrom and Gonzalo Navarro: Flexible and Efficient
+   Bit-Parallel Techniques for Transposition Invariant Approximate Matching
    in Music Retrieval.
 */
 
 
 #include "song.h"
 #include <string.h>
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DYNPROG_AVX2
+#include <immintrin.h>
+#endif
+
+/* ID = cost of indel operation */
+#define ID 1
+
+/* number of 16-bit lanes (transpositions) in one AVX2 register */
+#define DYNPROG_LANES 16
+
+
+/* Best match found so far: distance, first and last chord index and transposition.
+   found is set when the current track offers a match. mapping and pattern_size map positions of the current track to chord indexes. */
+typedef struct {
+	int distance;
+	int firstchordind;
+	int chordind;
+	int tp;
+	int found;
+	unsigned int *mapping;
+	int pattern_size;
+} dynprogBest;
+
+
+/*
+   Offers a candidate to the best match. Candidates must be offered in the order of
+   track, transposition and position; on equal distances the last one is kept.
+   Position j refers to the (gap-free) track position j + 1.
+*/
+static inline void dynprog_offer(dynprogBest *best, int distance, int j, int tp)
+{
+	if (distance <= best->distance)
+	{
+		best->distance = distance;
+		best->firstchordind = best->mapping[max2(j - best->pattern_size + 1, 0) + 1] - 1;
+		best->chordind = best->mapping[j + 1] - 1;
+		best->tp = tp;
+		best->found = 1;
+	}
+}
+
+
+/*
+   Scalar kernel: runs the column recurrence separately for each transposition tpmin...tpmax.
+   Returns 1 if it stopped at the deadline before the last transposition, otherwise 0.
+*/
+static int dynprog_track_scalar(char *track, unsigned int tracklen, char *p, unsigned int pattern_size, int tpmin, int tpmax, dynprogBest *best, double deadline)
+{
+	unsigned int i, j, ip, jp;
+	int tp, min1, min2, min3;
+	int columna[MAX_PATTERN_NOTES + 1], oldcolumna[MAX_PATTERN_NOTES + 1], *temp, *oldcolumn, *column;
+
+	oldcolumn = oldcolumna;
+	column = columna;
+
+	/* for each transposition */
+	for (tp = tpmin; tp <= tpmax; tp++)
+	{
+		if (tp > tpmin && deadline_passed(deadline)) return 1;
+
+		/* initialize left column (old column) */
+		for (i = 0; i <= pattern_size; i++) { oldcolumn[i] = i * ID; column[i] = 0; }
+
+		/* for each note on the track */
+		for (j = 0, jp = 1; j < tracklen; j++, jp++)
+		{
+			column[0] = j * ID;
+
+			for (i = 0, ip = 1; i < pattern_size; i++, ip++)
+			{
+				min1 = abs(track[jp] - p[ip] - tp) + oldcolumn[i];
+				min2 = ID + column[i];
+				min3 = ID + oldcolumn[ip];
+
+				if (min1 < min2)
+				{
+					if (min1 < min3) column[ip] = min1;
+					else column[ip] = min3;
+				}
+				else
+				{
+					if (min2 < min3) column[ip] = min2;
+					else column[ip] = min3;
+				}
+			}
+
+			dynprog_offer(best, column[pattern_size], j, tp);
+
+			temp = oldcolumn;
+			oldcolumn = column;
+			column = temp;
+		}
+	}
+	return 0;
+}
+
+
+#ifdef DYNPROG_AVX2
+/*
+   AVX2 kernel: evaluates 16 transpositions at a time, one per 16-bit lane.
+   Lanes use saturating arithmetic, so values above INT16_MAX are clamped; only distances
+   not larger than best->distance (at most the allowed errors) are ever reported, so clamping does not change results.
+   Each lane keeps its own best (distance, chord index), and lanes are offered to the global best in
+   transposition order after the whole track has been scanned, which keeps the scalar tie-breaking.
+   Returns 1 if it stopped at the deadline before the last group of transpositions, otherwise 0.
+*/
+__attribute__((target("avx2")))
+static int dynprog_track_avx2(char *track, unsigned int tracklen, char *p, unsigned int pattern_size, int tpmin, int tpmax, dynprogBest *best, double deadline)
+{
+	__m256i columna[MAX_PATTERN_NOTES + 1], oldcolumna[MAX_PATTERN_NOTES + 1], *temp, *oldcolumn, *column;
+	__m256i tpv, one, lanebestv, cost, min1, min2, min3;
+	short lanebest[DYNPROG_LANES], lastcolumn[DYNPROG_LANES];
+	int lanechord[DYNPROG_LANES];
+	unsigned int i, j, ip, jp, l, mask;
+	int tp0, limit;
+
+	one = _mm256_set1_epi16(ID);
+	limit = min2(best->distance, INT16_MAX);
+
+	for (tp0 = tpmin; tp0 <= tpmax; tp0 += DYNPROG_LANES)
+	{
+		if (tp0 > tpmin && deadline_passed(deadline)) return 1;
+
+		oldcolumn = oldcolumna;
+		column = columna;
+
+		/* lane l evaluates transposition tp0 + l */
+		tpv = _mm256_setr_epi16(tp0, tp0 + 1, tp0 + 2, tp0 + 3, tp0 + 4, tp0 + 5, tp0 + 6, tp0 + 7, \
+			tp0 + 8, tp0 + 9, tp0 + 10, tp0 + 11, tp0 + 12, tp0 + 13, tp0 + 14, tp0 + 15);
+
+		/* initialize left column (old column) */
+		for (i = 0; i <= pattern_size; i++) { oldcolumn[i] = _mm256_set1_epi16(i * ID); column[i] = _mm256_setzero_si256(); }
+
+		for (l = 0; l < DYNPROG_LANES; l++) { lanebest[l] = limit; lanechord[l] = -1; }
+		lanebestv = _mm256_set1_epi16(limit);
+
+		/* for each note on the track; track and pattern reads are shared by all lanes */
+		for (j = 0, jp = 1; j < tracklen; j++, jp++)
+		{
+			column[0] = _mm256_set1_epi16(min2(j * ID, INT16_MAX));
+
+			for (i = 0, ip = 1; i < pattern_size; i++, ip++)
+			{
+				cost = _mm256_abs_epi16(_mm256_sub_epi16(_mm256_set1_epi16(track[jp] - p[ip]), tpv));
+				min1 = _mm256_adds_epi16(cost, oldcolumn[i]);
+				min2 = _mm256_adds_epi16(one, column[i]);
+				min3 = _mm256_adds_epi16(one, oldcolumn[ip]);
+				column[ip] = _mm256_min_epi16(min1, _mm256_min_epi16(min2, min3));
+			}
+
+			/* lanes whose distance is not larger than their best so far */
+			mask = _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_min_epi16(column[pattern_size], lanebestv), column[pattern_size]));
+			if (mask)
+			{
+				_mm256_storeu_si256((__m256i *) lastcolumn, column[pattern_size]);
+				for (l = 0; l < DYNPROG_LANES; l++)
+				{
+					if ((mask >> (2 * l)) & 1)
+					{
+						lanebest[l] = lastcolumn[l];
+						lanechord[l] = j;
+					}
+				}
+				lanebestv = _mm256_loadu_si256((__m256i *) lanebest);
+			}
+
+			temp = oldcolumn;
+			oldcolumn = column;
+			column = temp;
+		}
+
+		/* lanes past tpmax are padding */
+		for (l = 0; l < DYNPROG_LANES && tp0 + (int) l <= tpmax; l++)
+		{
+			if (lanechord[l] >= 0) dynprog_offer(best, lanebest[l], lanechord[l], tp0 + l);
+		}
+	}
+	return 0;
+}
+#endif
 
 
 /*
 	Naive dynamic programming algorithm for comparison purposes. Transposition invariant.
-	Handles each track separately.
+	Handles each track separately. Gap symbols are not part of the tracks; the gap-free tracks are created at conversion.
+
+	Only transpositions within the pitch ranges of the track and the pattern are evaluated:
+	outside them every substitution costs more than at the nearest end of the range, so they cannot
+	produce a best match when fewer errors than pattern notes are allowed.
+	On processors with AVX2 the transpositions are evaluated 16 at a time; results are identical.
+	The deadline of the search is checked between tracks and transpositions; a song not finished by then has no match.
 */
 VALUE c_dynprog_scan(VALUE self, VALUE init_info)
 {
-	VALUE tracks_ary = Qnil, result_list;
-	char *p, *track;
-	unsigned int pattern_size, trackind, num_chords = 0, num_notes, num_tracks = 0, i, j, ip, jp;
-	int errors, tp, len;
-	/* ID = cost of indel operation; sigma = vocabulary size (here size of MIDI pitch range) */
-	int sigma = 128, ID = 1;
-	int mindistance = INT_MAX, minchordind = 0, mintp = 0, min1, min2, min3;
-	int columna[MAX_PATTERN_NOTES + 1], oldcolumna[MAX_PATTERN_NOTES + 1], initcolumn[MAX_PATTERN_NOTES + 1], *temp, *oldcolumn, *column;
+	VALUE result_list;
+	char *p, *compacted, *track;
+	unsigned int pattern_size, trackind, num_chords = 0, num_tracks = 0, tracklen, i, j, *mappings, *offsets, *aliases;
+	int errors, tpmin, tpmax, trackmin, trackmax, pmin, pmax, found = 0, stopped = 0;
+	double deadline;
+	/* sigma = vocabulary size (here size of MIDI pitch range) */
+	int sigma = 128;
+	static int use_avx2 = -1;
+	dynprogBest best, *trackbest;
 
 	/* Test for pattern and chord array sizes */
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
 	num_chords = NUM2UINT(rb_iv_get(self, "@num_chords"));
-	num_notes = NUM2UINT(rb_iv_get(self, "@num_notes"));
-	if (pattern_size > num_chords) return Qnil;
+	if (pattern_size > num_chords || pattern_size > MAX_PATTERN_NOTES) return Qnil;
 
 	/* Get the rest of parameters */
 	p = (char *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_pitch_string"));
 	errors = NUM2INT(rb_iv_get(init_info, "@errors"));
-	tracks_ary = rb_iv_get(self, "@tracks");
+	compacted = (char *) RSTRING_PTR(rb_iv_get(self, "@compacted_tracks"));
+	mappings = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_mappings"));
+	offsets = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_offsets"));
 	num_tracks = NUM2UINT(rb_iv_get(self, "@num_tracks"));
+	aliases = song_track_aliases(self, num_tracks);
 	result_list = rb_iv_get(init_info, "@matches");
+	deadline = search_deadline(init_info);
 
-	/* initialize first column */
-	for (i = 0; i <= pattern_size; i++) initcolumn[i] = i * ID;
-	len = sizeof(int) * (pattern_size + 1);
-	oldcolumn = oldcolumna;
-	column = columna;
+#ifdef DYNPROG_AVX2
+	if (use_avx2 < 0) use_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+#else
+	use_avx2 = 0;
+#endif
+
+	/* only distances up to errors are reported */
+	best.distance = errors * ID;
+	best.firstchordind = 0;
+	best.chordind = 0;
+	best.tp = 0;
+	best.found = 0;
+	best.pattern_size = pattern_size;
+
+	for (pmin = sigma, pmax = -sigma, i = 1; i <= pattern_size; i++) { pmin = min2(pmin, p[i]); pmax = max2(pmax, p[i]); }
+
+	/* best match offered by each track (found is set for the tracks that offered one) */
+	trackbest = (dynprogBest *) calloc(num_tracks + 1, sizeof(dynprogBest));
 
 	/* for each track */
-	for (trackind = 1; trackind <= num_tracks; trackind++)
+	for (trackind = 1; trackind <= num_tracks && !stopped; trackind++)
 	{
-		track = (char *) RSTRING_PTR(RARRAY_PTR(tracks_ary)[trackind]);
-
-		/* for each transposition */
-		for (tp = -sigma + 1; tp < sigma; tp++)
+		/* a copy of an earlier track offers the same candidates; only its best one can be kept */
+		if (TRACK_ALIAS(aliases, trackind) != trackind)
 		{
-			/* initialize left column (old column) */
-			for (i = 0; i <= pattern_size; i++) { oldcolumn[i] = initcolumn[i]; column[i] = 0; }
-
-			/* for each note on the track */
-			for (j = 0, jp = 1; j < num_chords; j++, jp++)
+			if (trackbest[TRACK_ALIAS(aliases, trackind)].found && trackbest[TRACK_ALIAS(aliases, trackind)].distance <= best.distance)
 			{
-				column[0] = j * ID;
-				
-				for (i = 0, ip = 1; i < pattern_size; i++, ip++)
-				{
-					min1 = abs(track[jp] - p[ip] - tp) + oldcolumn[i];
-					min2 = ID + column[i];
-					min3 = ID + oldcolumn[ip];
-
-					if (min1 < min2)
-					{
-						if (min1 < min3) column[ip] = min1;
-						else column[ip] = min3;
-					}
-					else
-					{
-						if (min2 < min3) column[ip] = min2;
-						else column[ip] = min3;
-					}
-				}
+				best = trackbest[TRACK_ALIAS(aliases, trackind)];
+				found = 1;
+			}
+			continue;
+		}
 
-				if (column[pattern_size] <= mindistance)
-				{
-					mindistance = column[pattern_size];
-					minchordind = j;
-					mintp = tp;
-				}
+		track = compacted + offsets[trackind - 1];
+		tracklen = COMPACTED_LEN(offsets, trackind);
+		if (tracklen == 0) continue;
+		if (trackind > 1 && deadline_passed(deadline)) { stopped = 1; break; }
+		best.mapping = mappings + offsets[trackind - 1];
+		best.found = 0;
 
-				temp = oldcolumn;
-				oldcolumn = column;
-				column = temp;
+		tpmin = -sigma + 1;
+		tpmax = sigma - 1;
+		if (errors < (int) pattern_size)
+		{
+			for (trackmin = sigma, trackmax = -sigma, j = 1; j <= tracklen; j++)
+			{
+				trackmin = min2(trackmin, track[j]);
+				trackmax = max2(trackmax, track[j]);
 			}
+			tpmin = max2(tpmin, trackmin - pmax);
+			tpmax = min2(tpmax, trackmax - pmin);
 		}
+
+#ifdef DYNPROG_AVX2
+		if (use_avx2) stopped = dynprog_track_avx2(track, tracklen, p, pattern_size, tpmin, tpmax, &best, deadline);
+		else
+#endif
+		stopped = dynprog_track_scalar(track, tracklen, p, pattern_size, tpmin, tpmax, &best, deadline);
+		if (best.found) { trackbest[trackind] = best; found = 1; }
+	}
+	free(trackbest);
+
+	/* the best match of the tracks scanned so far may not be that of the song */
+	if (stopped)
+	{
+		search_timed_out(init_info, result_list, RARRAY_LEN(result_list));
+		return result_list;
 	}
 
 	/* Process results */
-	if (mindistance <= errors * ID) rb_ary_push(result_list, rb_ary_new3(6, self, INT2NUM(max2(minchordind - (int) pattern_size + 1, 0)), INT2NUM(minchordind), Qnil, INT2FIX(mintp), INT2FIX(mindistance)));
+	if (found) rb_ary_push(result_list, rb_ary_new3(6, self, INT2NUM(best.firstchordind), INT2NUM(best.chordind), Qnil, INT2FIX(best.tp), INT2FIX(best.distance)));
 
 	return result_list;
 }
@@ -0,0 +1,225 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Bit-parallel counterpart of the dynamic programming algorithm in dynprog.c.
+   Uses the bit-vector simulation of the edit distance matrix by Gene Myers:
+   A Fast Bit-Vector Algorithm for Approximate String Matching Based on Dynamic Programming.
+   Journal of the ACM 46(3), 1999, with the blocked version for patterns longer than a machine word,
+   and transposition invariance as in Kjell Lemstrom and Gonzalo Navarro: Flexible and Efficient
+   Bit-Parallel Techniques for Transposition Invariant Approximate Matching in Music Retrieval.
+*/
+
+
+#include "song.h"
+#include <string.h>
+
+#define BP_WORDBITS (sizeof(unsigned long) * 8)
+
+
+/*
+   Pattern preprocessing. Builds table t that has a bit vector of (pattern_size / word size) words
+   for each pitch. Bit i of the vector is set if pattern position i + 1 has this pitch.
+   Transpositions are handled in the scanning phase by shifting the index to t.
+*/
+VALUE c_dynprog_bp_init(VALUE self, VALUE init_info)
+{
+	unsigned int i, pattern_size, words;
+	unsigned long *t;
+	unsigned char *p;
+	VALUE t_str;
+
+	p = (unsigned char *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_pitch_string"));
+	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
+	words = (pattern_size + BP_WORDBITS - 1) / BP_WORDBITS;
+
+	/* string is zero-filled by rb_str_new when the pointer is NULL */
+	t_str = rb_str_new(NULL, 128 * words * sizeof(unsigned long));
+	t = (unsigned long *) RSTRING_PTR(t_str);
+	memset(t, 0, 128 * words * sizeof(unsigned long));
+
+	/* pattern string starts from index 1 */
+	for (i = 0; i < pattern_size; i++) t[(p[i + 1] & 127) * words + i / BP_WORDBITS] |= 1UL << (i % BP_WORDBITS);
+
+	rb_iv_set(init_info, "@t", t_str);
+	return init_info;
+}
+
+
+/*
+   Advances one block of the bit vectors by one text column.
+   hin is the horizontal delta entering the block from below (the previous block),
+   return value is the delta leaving the block at bit hb.
+*/
+static inline int advance_block(unsigned long *pv, unsigned long *mv, unsigned long eq, int hin, unsigned long hb)
+{
+	unsigned long xv, xh, ph, mh;
+	int hout = 0;
+
+	xv = eq | *mv;
+	if (hin < 0) eq |= 1;
+	xh = (((eq & *pv) + *pv) ^ *pv) | eq;
+
+	ph = *mv | ~(xh | *pv);
+	mh = *pv & xh;
+
+	if (ph & hb) hout = 1;
+	else if (mh & hb) hout = -1;
+
+	ph <<= 1;
+	mh <<= 1;
+	if (hin < 0) mh |= 1;
+	else if (hin > 0) ph |= 1;
+
+	*pv = mh | ~(xv | ph);
+	*mv = ph & xv;
+	return hout;
+}
+
+
+/*
+   Transposition invariant approximate matching with unit cost edit distance. Handles each track separately.
+   For each transposition, the text column is scanned once using bit vectors of the pattern
+   (one word per BP_WORDBITS pattern notes), so that a column costs O(pattern_size / word size) instead of O(pattern_size).
+   Gap symbols are not part of the tracks; the gap-free tracks are created at conversion.
+
+   Follows c_dynprog_scan except for the substitution cost, which is 1 for different pitches instead of their
+   difference; weighted costs do not fit the bit-vector formulation. As in c_dynprog_scan, the top row of the
+   matrix grows by one per text position after the first (column[0] = j * ID), the same transpositions are
+   evaluated, and only the best match of each song is reported: candidates are offered in the order of track, 
+   transposition and position, and on equal distances the last one is kept.
+   The deadline of the search is checked between transpositions; a song not finished by then has no match.
+
+   Patterns longer than a word use blocks of words. Client patterns have at most 30 notes, so only direct 
+   callers use blocks.
+*/
+VALUE c_dynprog_bp_scan(VALUE self, VALUE init_info)
+{
+	VALUE result_list;
+	unsigned char *p, *compacted, *track;
+	unsigned int pattern_size, num_chords, num_tracks, trackind, tracklen, words, w, i, j, *mappings, *offsets, *mapping, *aliases;
+	unsigned long *t, *pv, *mv, *eqs, hb, lastbit;
+	int errors, tp, tpmin, tpmax, c, score, hin, pmin = 127, pmax = 0, trackmin, trackmax, found = 0, stopped = 0;
+	double deadline;
+	/* best match (distance, first and last chord index, transposition) so far, and of each track */
+	int best[4], (*trackbest)[4], *trackfound;
+
+	/* Test for pattern and chord array sizes */
+	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
+	num_chords = NUM2UINT(rb_iv_get(self, "@num_chords"));
+	if (pattern_size > num_chords || pattern_size == 0) return Qnil;
+
+	/* Get the rest of parameters */
+	p = (unsigned char *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_pitch_string"));
+	t = (unsigned long *) RSTRING_PTR(rb_iv_get(init_info, "@t"));
+	errors = NUM2INT(rb_iv_get(init_info, "@errors"));
+	compacted = (unsigned char *) RSTRING_PTR(rb_iv_get(self, "@compacted_tracks"));
+	mappings = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_mappings"));
+	offsets = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_offsets"));
+	num_tracks = NUM2UINT(rb_iv_get(self, "@num_tracks"));
+	aliases = song_track_aliases(self, num_tracks);
+	result_list = rb_iv_get(init_info, "@matches");
+	deadline = search_deadline(init_info);
+
+	words = (pattern_size + BP_WORDBITS - 1) / BP_WORDBITS;
+	lastbit = 1UL << ((pattern_size - 1) % BP_WORDBITS);
+	for (i = 1; i <= pattern_size; i++) { pmin = min2(pmin, p[i]); pmax = max2(pmax, p[i]); }
+
+	pv = (unsigned long *) malloc(3 * words * sizeof(unsigned long));
+	mv = pv + words;
+	eqs = mv + words;
+	trackbest = (int (*)[4]) malloc((num_tracks + 1) * sizeof(*trackbest));
+	trackfound = (int *) calloc(num_tracks + 1, sizeof(int));
+
+	/* only distances up to errors are reported */
+	best[0] = errors;
+	best[1] = best[2] = best[3] = 0;
+
+	/* for each track */
+	for (trackind = 1; trackind <= num_tracks && !stopped; trackind++)
+	{
+		/* a copy of an earlier track offers the same candidates; only its best one can be kept */
+		if (TRACK_ALIAS(aliases, trackind) != trackind)
+		{
+			if (trackfound[TRACK_ALIAS(aliases, trackind)] && trackbest[TRACK_ALIAS(aliases, trackind)][0] <= best[0])
+			{
+				memcpy(best, trackbest[TRACK_ALIAS(aliases, trackind)], sizeof(best));
+				found = 1;
+			}
+			continue;
+		}
+
+		/* positions 1...tracklen; skip the unused position 0 */
+		track = compacted + offsets[trackind - 1] + 1;
+		mapping = mappings + offsets[trackind - 1] + 1;
+		tracklen = COMPACTED_LEN(offsets, trackind);
+		if (tracklen == 0) continue;
+
+		/* transpositions of c_dynprog_scan: those between the pitch ranges of the track and the pattern,
+		   unless every note may be an error */
+		tpmin = -127;
+		tpmax = 127;
+		if (errors < (int) pattern_size)
+		{
+			for (trackmin = 127, trackmax = 0, j = 0; j < tracklen; j++) { trackmin = min2(trackmin, track[j]); trackmax = max2(trackmax, track[j]); }
+			tpmin = max2(tpmin, trackmin - pmax);
+			tpmax = min2(tpmax, trackmax - pmin);
+		}
+
+		for (tp = tpmin; tp <= tpmax; tp++)
+		{
+			/* the deadline is checked between transpositions, which also covers the start of each track */
+			if ((trackind > 1 || tp > tpmin) && deadline_passed(deadline)) { stopped = 1; break; }
+
+			for (w = 0; w < words; w++) { pv[w] = ~0UL; mv[w] = 0; }
+			score = pattern_size;
+
+			for (j = 0; j < tracklen; j++)
+			{
+				/* pattern pitch that matches this note in transposition tp */
+				c = (int) track[j] - tp;
+				if (c >= 0 && c < 128) memcpy(eqs, t + c * words, words * sizeof(unsigned long));
+				else memset(eqs, 0, words * sizeof(unsigned long));
+
+				/* the top row grows by one from the second position on */
+				for (hin = (j > 0), w = 0; w < words; w++)
+				{
+					hb = (w == words - 1) ? lastbit : 1UL << (BP_WORDBITS - 1);
+					hin = advance_block(&pv[w], &mv[w], eqs[w], hin, hb);
+				}
+				score += hin;
+
+				if (score <= best[0])
+				{
+					/* map back to chord indexes; the start is approximated as in c_dynprog_scan */
+					best[0] = score;
+					best[1] = mapping[max2((int) j - (int) pattern_size + 1, 0)] - 1;
+					best[2] = mapping[j] - 1;
+					best[3] = tp;
+					memcpy(trackbest[trackind], best, sizeof(best));
+					trackfound[trackind] = found = 1;
+				}
+			}
+		}
+	}
+
+	free(pv);
+	free(trackbest);
+	free(trackfound);
+
+	/* a song not scanned completely before the deadline has no match */
+	if (stopped)
+	{
+		search_timed_out(init_info, result_list, RARRAY_LEN(result_list));
+		return result_list;
+	}
+
+	/* Process results */
+	if (found) rb_ary_push(result_list, rb_ary_new3(6, self, INT2NUM(best[1]), INT2NUM(best[2]), Qnil, INT2FIX(best[3]), INT2FIX(best[0])));
+
+	return result_list;
+}
@@ -52,6 +52,7 @@ static unsigned int next_note(char *chords, unsigned int *chords_size, unsigned
 */
 VALUE c_geometric_p1_scan(VALUE self, VALUE init_info)
 {
+	volatile VALUE chords_str;
 	VALUE zero, result_list = Qnil, matchednotes_obj[MAX_PATTERN_NOTES];
 	char *chords;
 	unsigned int pi = 0, k = 0, pattern_size, end, quarternoteduration;
@@ -69,7 +70,8 @@ VALUE c_geometric_p1_scan(VALUE self, VALUE init_info)
 	if (pattern_size > chords_size || pattern_size > MAX_PATTERN_NOTES) return Qnil;
 	
 	pattern = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_polyphonic_vector"));
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = search_chords(self, init_info);
+	chords = (char *) RSTRING_PTR(chords_str);
 	num_notes = NUM2UINT(rb_iv_get(self, "@num_notes"));
 	quarternoteduration = NUM2UINT(rb_iv_get(self, "@quarternoteduration"));
 	zero = INT2FIX(0);
@@ -163,12 +165,12 @@ VALUE c_geometric_p1_scan(VALUE self, VALUE init_info)
 unsigned int next_note(char *chords, unsigned int *chords_size, unsigned int *chordind, unsigned int *chordspos, unsigned int *noteind, unsigned int *notespos)
 {
 	/* at the end of source; return */
-	if (*chordind + 1 == *chords_size && (unsigned int) *(chords + *chordspos) == *noteind + 1) return 1;
+	if (*chordind + 1 == *chords_size && CHORDLEN(chords + *chordspos) == *noteind + 1) return 1;
 
 	*noteind += 1;
 
 	/* at the end of current chord; must cross chord boundary. */
-	if (*noteind == (unsigned int) *(chords + *chordspos))
+	if (*noteind == CHORDLEN(chords + *chordspos))
 	{
 		*chordind += 1;
 		*noteind = 0;
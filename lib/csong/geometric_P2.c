@@ -66,6 +66,7 @@ VALUE c_geometric_p2_init(VALUE self, VALUE init_info)
 */
 VALUE c_geometric_p2_scan(VALUE self, VALUE init_info)
 {
+	volatile VALUE chords_str;
 	VALUE result_list = Qnil, matchednotes_obj[MAX_PATTERN_NOTES];
 	char *chords;
 	unsigned int matchednotes[MAX_PATTERN_NOTES];
@@ -84,7 +85,8 @@ VALUE c_geometric_p2_scan(VALUE self, VALUE init_info)
 
 	if (pattern_chords > chords_size || pattern_notes > MAX_PATTERN_NOTES) return Qnil;
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = search_chords(self, init_info);
+	chords = (char *) RSTRING_PTR(chords_str);
 	num_notes = NUM2UINT(rb_iv_get(self, "@num_notes"));
 	quarternoteduration = NUM2UINT(rb_iv_get(self, "@quarternoteduration")) ;
 
@@ -114,7 +116,7 @@ VALUE c_geometric_p2_scan(VALUE self, VALUE init_info)
 		q[i].chordind = 0;
 		q[i].chordspos = 0;		/* relative pointer. refer to start of chord with (chords + q[i].chordspos).*/
 		q[i].notespos = CHORDHEADERLEN; /* relative pointer. refer to actual note with chords[q[i].notespos] */
-		q[i].notesleft = chords[0] - 1;
+		q[i].notesleft = CHORDLEN(chords) - 1;
 
 		/* add translation vectors to the priority queue */
 		/* MIDI division in different songs may differ. pattern uses 960 units per quarter note, */
@@ -180,7 +182,7 @@ VALUE c_geometric_p2_scan(VALUE self, VALUE init_info)
 			q[min_key].chordind++;
 			q[min_key].chordspos = q[min_key].notespos + NOTELEN;
 			q[min_key].notespos = q[min_key].chordspos + CHORDHEADERLEN;
-			q[min_key].notesleft = *((char *) (chords + q[min_key].chordspos)) - 1;
+			q[min_key].notesleft = CHORDLEN(chords + q[min_key].chordspos) - 1;
 
 			/* add difference vector corresponding to pattern note min_key. */
 			PQ_updateValue(tree, leaves, min_key,  (int) *((unsigned int *) (chords + q[min_key].chordspos + 1)) - \
@@ -18,11 +18,13 @@
 */
 VALUE c_pitch_histogram(VALUE self)
 {
+	volatile VALUE chords_str;
 	VALUE pitches_obj[128];
 	char *chords, *cp;
 	unsigned int i, j, chords_size, chordlen, pitches[128];
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	for (i = 0; i < 128; i++) pitches[i] = 0;
 
@@ -30,7 +32,7 @@ VALUE c_pitch_histogram(VALUE self)
 	for (cp = chords, i = 0; i < chords_size; i++)
 	{
 		/* get chord size */
-		chordlen = *cp;
+		chordlen = CHORDLEN(cp);
 		cp += CHORDHEADERLEN;
 
 		/* scan all notes in a chord */
@@ -48,11 +50,13 @@ VALUE c_pitch_histogram(VALUE self)
 */
 VALUE c_pitch_histogram_folded(VALUE self)
 {
+	volatile VALUE chords_str;
 	VALUE pitches_obj[12];
 	char *chords, *cp;
 	unsigned int i, j, chords_size, chordlen, pitches[12];
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	for (i = 0; i < 12; i++) pitches[i] = 0;
 
@@ -60,7 +64,7 @@ VALUE c_pitch_histogram_folded(VALUE self)
 	for (cp = chords, i = 0; i < chords_size; i++)
 	{
 		/* get chord size */
-		chordlen = *cp;
+		chordlen = CHORDLEN(cp);
 		cp += CHORDHEADERLEN;
 
 		/* scan all notes in a chord */
@@ -91,39 +95,39 @@ VALUE c_pitch_histogram_folded(VALUE self)
 */
 VALUE c_pitch_interval_histogram(VALUE self)
 {
+	volatile VALUE chords_str;
 	VALUE intervals_obj[255];
-	char *chords, *cp, *pp, *temp;
+	unsigned char *chords, *cp, *pp, *prev;
 	unsigned int i, j, k, chords_size, chordlen, prevchordlen, intervals[255];
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (unsigned char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	for (i = 0; i < 255; i++) intervals[i] = 0;
 
-	/* scan all chords, start from the second chord */
-	pp = chords;
-	prevchordlen = *pp;
-	pp += CHORDHEADERLEN;
-	cp = chords + CHORDHEADERLEN + chords[0] * NOTELEN;
+	/* scan all chords, start from the second chord; the pseudo infinity chord is not included */
+	prevchordlen = CHORDLEN(chords);
+	prev = chords + CHORDHEADERLEN;
+	cp = prev + prevchordlen * NOTELEN;
 
-	for (i = 0; i < chords_size; i++)
+	for (i = 1; i < chords_size; i++)
 	{
 		/* get chord size */
-		chordlen = *cp;
+		chordlen = CHORDLEN(cp);
 		cp += CHORDHEADERLEN;
-		temp = cp;
 
 		/* scan all notes in a chord */
 		for (j = 0; j < chordlen; j++, cp += NOTELEN)
 		{
 			/* scan all notes in the previous chord */
-			for (k = 0; k < prevchordlen; k++, pp += NOTELEN)
+			for (k = 0, pp = prev; k < prevchordlen; k++, pp += NOTELEN)
 			{
 				/* calculate interval */
 				intervals[127 + (int) *cp - (int) *pp] += 1;
 			}
 		}
 		prevchordlen = chordlen;
-		pp = temp;
+		prev = cp - chordlen * NOTELEN;
 	}
 
 	for (i = 0; i < 255; i++) intervals_obj[i] = UINT2NUM(intervals[i]);
@@ -147,19 +151,21 @@ VALUE c_pitch_interval_histogram(VALUE self)
 */
 VALUE c_duration_histogram(VALUE self)
 {
+	volatile VALUE chords_str;
 	VALUE durations_obj[11];
 	char *chords, *cp;
 	unsigned int i, j, k, chords_size, chordlen;
 	double dur = 0, fullnoteduration, temp, durations[11];
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	fullnoteduration = 4 * NUM2DBL(rb_iv_get(self, "@quarternoteduration"));
 	for (i = 0; i < 11; i++) durations[i] = 0;
 
 	for (cp = chords, i = 0; i < chords_size; i++)
 	{
-		chordlen = *cp;
+		chordlen = CHORDLEN(cp);
 		cp += CHORDHEADERLEN;
 		//printf("chord %u/%u: len=%u\n", i, chords_size, chordlen);
 
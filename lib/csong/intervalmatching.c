@@ -18,12 +18,12 @@
 #include "song.h"
 
 
-VALUE c_matchcheck(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, VALUE result_list);
-VALUE c_matchcheck_oe(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, VALUE result_list);
+VALUE c_matchcheck(VALUE self, pitchset *pitchsets, char *pp, size_t itemsize, unsigned int chordind, vector *pattern, unsigned int pattern_size, VALUE result_list);
 
 /*
    Pattern preprocessing and internal data structure initialization. 
    Consult the article for details.
+   Tables are cached by transposition-normalised pattern.
 */
 VALUE c_intervalmatching_init(VALUE self, VALUE init_info)
 {
@@ -31,11 +31,15 @@ VALUE c_intervalmatching_init(VALUE self, VALUE init_info)
 	unsigned int e, t[13];
 	int ii = 0;
 	vector *pattern;
+	VALUE key;
 
 	pattern = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_monophonic_vector"));
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
 
-	e = (unsigned int) pow(2, pattern_size - 1) - 1;
+	key = pattern_cache_key(PC_INTERVALMATCHING, pattern, pattern_size, 1);
+	if (pattern_cache_fetch(PC_INTERVALMATCHING, key, init_info)) return init_info;
+
+	e = BIT((int) pattern_size - 1) - 1;
 
 	for (i = 0; i <= VOCSIZE; i++) t[i] = e;
 
@@ -43,13 +47,14 @@ VALUE c_intervalmatching_init(VALUE self, VALUE init_info)
 	{
 		ii = (pattern[i].ptch - pattern[i - 1].ptch) % VOCSIZE;
 		while (ii < 0) ii += VOCSIZE;
-		t[ii] = t[ii] - (unsigned int) pow(2, i - 1);
+		t[ii] = t[ii] - BIT((int) i - 1);
 	}
 
 	rb_iv_set(init_info, "@pattern_size", INT2NUM(pattern_size));
 	rb_iv_set(init_info, "@t", rb_str_new((char *) t, 13 * sizeof(unsigned int)));
 	rb_iv_set(init_info, "@e", UINT2NUM(e));
-	rb_iv_set(init_info, "@em", INT2NUM(pow(2, pattern_size) - 1 - pow(2, pattern_size - 2)));
+	rb_iv_set(init_info, "@em", UINT2NUM(LOWBITS(pattern_size) - BIT((int) pattern_size - 2)));
+	pattern_cache_store(PC_INTERVALMATCHING, key, init_info);
 
 	return init_info;
 }
@@ -64,13 +69,16 @@ VALUE c_intervalmatching_init(VALUE self, VALUE init_info)
 */
 VALUE c_intervalmatching_scan(VALUE self, VALUE init_info)
 {
-	VALUE result_list = Qnil, result;
+	volatile VALUE chords_str;
+	VALUE result_list = Qnil, result, preprocessed;
 	int ii = 0;
-	unsigned int pattern_size, i = 0, k = 0, chords_size, spos;
+	unsigned int pattern_size, chords_size;
 	unsigned int tmp = 0, mask = 0, e = 0, em = 0, *t;
-	unsigned int chordind, chordlen, prevchordlen, prevchordspos;
+	unsigned int chordind, chordlen, prevchordlen;
+	size_t i = 0, k = 0, spos, prevchordspos, itemsize;
 	char *chords, *s;
 	vector *pattern;
+	pitchset *pitchsets;
 
 	pattern = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_monophonic_vector"));
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
@@ -79,24 +87,28 @@ VALUE c_intervalmatching_scan(VALUE self, VALUE init_info)
 	em = NUM2UINT(rb_iv_get(init_info, "@em"));
 	t = (unsigned int *) RSTRING_PTR(rb_iv_get(init_info, "@t"));
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = search_chords(self, init_info);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
+	pitchsets = (pitchset *) RSTRING_PTR(rb_iv_get(self, "@pitchsets"));
 
-	/* preprocessed string consists of (spos:4, intervaldata:2) pairs */
-	s = (char *) RSTRING_PTR(rb_iv_get(self, "@preprocessed"));
+	/* preprocessed string consists of (spos, intervaldata:2) items; see song.h */
+	preprocessed = rb_iv_get(self, "@preprocessed");
+	s = (char *) RSTRING_PTR(preprocessed);
+	itemsize = pp_item_size(preprocessed, chords_size);
 
 	result_list = rb_iv_get(init_info, "@matches");
 
-	prevchordlen = chords[0];
+	prevchordlen = CHORDLEN(chords);
 	prevchordspos = 0;
 
 	/* scan all chords, start from the second chord */
-	for (spos = CHORDHEADERLEN + chords[0] * NOTELEN, chordind = 1; chordind < chords_size; chordind++, spos += CHORDHEADERLEN + NOTELEN * prevchordlen)
+	for (spos = CHORDHEADERLEN + prevchordlen * NOTELEN, chordind = 1; chordind < chords_size; chordind++, spos += CHORDHEADERLEN + NOTELEN * prevchordlen)
 	{
 		tmp = mask;
 
 		/* for each note in the current chord */
-		for (chordlen = chords[spos], i = spos + CHORDHEADERLEN; i < spos + CHORDHEADERLEN + chordlen * NOTELEN; i += NOTELEN)
+		for (chordlen = CHORDLEN(chords + spos), i = spos + CHORDHEADERLEN; i < spos + CHORDHEADERLEN + chordlen * NOTELEN; i += NOTELEN)
 		{
 			/* for each note in the previous chord */
 			for (k = prevchordspos + CHORDHEADERLEN; k < prevchordspos + CHORDHEADERLEN + prevchordlen * NOTELEN; k += NOTELEN)
@@ -116,7 +128,7 @@ VALUE c_intervalmatching_scan(VALUE self, VALUE init_info)
 
 		if ((e | em) == em)
 		{
-			result = c_matchcheck(self, chords, chordind - pattern_size + 1, *((unsigned int *)(s + PP_ITEM_SIZE * (chordind - pattern_size + 1))), \
+			result = c_matchcheck(self, pitchsets, s, itemsize, chordind - pattern_size + 1, \
 				pattern, pattern_size, result_list);
 		}
 	}
@@ -25,10 +25,12 @@
 */
 VALUE c_lcts_scan(VALUE self, VALUE init_info)
 {
-	VALUE zero, result_list, tracks_ary = Qnil;
-	char *p, *track, *temptrack, pitches[64], align_p[64], align_t[64]; /* NOTE: Fixed size. */
+	VALUE zero, result_list;
+	char *p, *compacted, *temptrack, pitches[64], align_p[64], align_t[64]; /* NOTE: Fixed size. */
 	unsigned int i = 0, chordind = 0, pattern_size, pind, trackind, tracklen;
-	unsigned int chords_size = 0, num_tracks = 0, *mapping;
+	unsigned int chords_size = 0, num_tracks = 0, *mapping, *mappings, *offsets, *aliases;
+	long *firstrow, row, lastrow;
+	double deadline;
 	int errors, j;
        	int startindex;
 	occType *occ = NULL;
@@ -46,32 +48,41 @@ VALUE c_lcts_scan(VALUE self, VALUE init_info)
 	result_list = rb_iv_get(init_info, "@matches");
 	p = (char *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_pitch_string"));
 	errors = NUM2INT(rb_iv_get(init_info, "@errors"));
+	deadline = search_deadline(init_info);
 
 	num_tracks = NUM2UINT(rb_iv_get(self, "@num_tracks"));
-	tracks_ary = rb_iv_get(self, "@tracks");
 
-	temptrack = (char *) calloc(chords_size + 1, sizeof(char));
-	mapping = (unsigned int *) calloc(chords_size + 1, sizeof(unsigned int));
+	/* tracks without the gap symbols used by e.g. splitting algorithm; created at conversion. */
+	compacted = (char *) RSTRING_PTR(rb_iv_get(self, "@compacted_tracks"));
+	mappings = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_mappings"));
+	offsets = (unsigned int *) RSTRING_PTR(rb_iv_get(self, "@compacted_offsets"));
+	aliases = song_track_aliases(self, num_tracks);
 
-	/* search each track separately. */
+	/* results of track k are items firstrow[k]...firstrow[k + 1] - 1 of the result list */
+	firstrow = (long *) malloc((num_tracks + 2) * sizeof(long));
+
+	/* search each track separately, until the deadline of the search. */
 	for (trackind = 1; trackind <= num_tracks; trackind++)
 	{
-		track = (char *) RSTRING_PTR(RARRAY_PTR(tracks_ary)[trackind]);
+		firstrow[trackind] = RARRAY_LEN(result_list);
+		if (trackind > 1 && deadline_passed(deadline))
+		{
+			search_timed_out(init_info, result_list, firstrow[1]);
+			break;
+		}
 
-		/* null characters indicate that there is no note in this chord on this track. */
-		/* they are used by e.g. splitting algorithm. here we must remove them. */
-		for (tracklen = 1, i = 1; i <= chords_size; i++) 
+		/* a copy of an earlier track has the same matches */
+		if (TRACK_ALIAS(aliases, trackind) != trackind)
 		{
-			if ((unsigned char) track[i] != GAP_UNSIGNED)
-			{
-				temptrack[tracklen] = track[i];
-				mapping[tracklen] = i;
-				// printf("%d=%d/%d %d %d\n", tracklen, mapping[tracklen],chords_size, track[i], temptrack[tracklen]);
-				tracklen++;
-			}
+			lastrow = firstrow[TRACK_ALIAS(aliases, trackind) + 1];
+			for (row = firstrow[TRACK_ALIAS(aliases, trackind)]; row < lastrow; row++)
+				rb_ary_push(result_list, rb_ary_dup(rb_ary_entry(result_list, row)));
+			continue;
 		}
-		tracklen--;
-		//printf("lengths: %d/%d track=%s\n", tracklen, chords_size, temptrack+1);
+
+		temptrack = compacted + offsets[trackind - 1];
+		mapping = mappings + offsets[trackind - 1];
+		tracklen = COMPACTED_LEN(offsets, trackind);
 
 		/* call search function */
 		occ = searchAllTranspositions(Mt, p, temptrack, pattern_size, tracklen, errors);
@@ -104,7 +115,7 @@ VALUE c_lcts_scan(VALUE self, VALUE init_info)
 		}
 		free(occ);
 	}
-	free(temptrack);
+	free(firstrow);
 
 	return result_list;
 }
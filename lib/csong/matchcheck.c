@@ -15,87 +15,92 @@
 
 
 /*
-   Checks that the candidates found by filtering methods are real occurrences.
-   Finds transposition invariant octave equivalent matches.
+   Returns set a shifted so that bit p of the result is bit p + amount of a. Negative amounts shift to the other direction.
 */
-VALUE c_matchcheck(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, VALUE result_list)
+static inline pitchset pitchset_shift(pitchset a, int amount)
 {
-	VALUE zero = Qnil, matchednotes_obj[31];
-	int pitch, x, y, transposition = 0;
-	unsigned int matchednotes[31], noteindex, nextindex, current_spos, next_spos, i;
-	unsigned char current_len, next_len, pattern_index, found, yfound;
+	pitchset r;
 
-	/* for all notes in the first chord do */
-	for (noteindex = 0; noteindex < (unsigned char) chords[spos]; noteindex++)
+	if (amount < 0)
+	{
+		amount = -amount;
+		if (amount >= 128) { r.w[0] = r.w[1] = 0; }
+		else if (amount >= 64) { r.w[1] = a.w[0] << (amount - 64); r.w[0] = 0; }
+		else if (amount > 0) { r.w[1] = (a.w[1] << amount) | (a.w[0] >> (64 - amount)); r.w[0] = a.w[0] << amount; }
+		else r = a;
+	}
+	else
 	{
-		pattern_index = 0;
-		found = 1;
-		current_spos = spos;
-		current_len = chords[current_spos];
+		if (amount >= 128) { r.w[0] = r.w[1] = 0; }
+		else if (amount >= 64) { r.w[0] = a.w[1] >> (amount - 64); r.w[1] = 0; }
+		else if (amount > 0) { r.w[0] = (a.w[0] >> amount) | (a.w[1] << (64 - amount)); r.w[1] = a.w[1] >> amount; }
+		else r = a;
+	}
+	return r;
+}
 
-		/* get the pitch of the current note */
-		pitch = (int) chords[spos + CHORDHEADERLEN + noteindex * NOTELEN];
 
-		matchednotes[pattern_index] = current_spos + CHORDHEADERLEN + noteindex * NOTELEN;
+/*
+   Returns the number of pitches below pitch p in set a, i.e. the index of note p in its chord,
+   since notes in a chord are unique and ordered by pitch.
+*/
+static inline unsigned int pitchset_rank(pitchset a, int p)
+{
+	if (p < 64) return __builtin_popcountll(a.w[0] & ((1ULL << p) - 1));
+	return __builtin_popcountll(a.w[0]) + __builtin_popcountll(a.w[1] & ((1ULL << (p - 64)) - 1));
+}
 
-		/* try to find a consequtive sequence of pitches in the following chords */
-		/* starting from c and corresponding to the intervals in the pattern */
-		while (found == 1 && pattern_index < pattern_size - 1)
-		{
-			/* must find x in the next chord */
-			x = pitch + (int) pattern[pattern_index + 1].ptch - (int) pattern[pattern_index].ptch;
 
-			/* position of the next chord (relative to current_spos) */
-			next_spos = current_spos + CHORDHEADERLEN + current_len * NOTELEN;
-			next_len = chords[next_spos];
+/*
+   Checks that the candidates found by filtering methods are real occurrences.
+   Finds transposition invariant matches starting at chord chordind.
 
-			/* try to find xx in ychord */
-			for (yfound = 0, nextindex = 0; nextindex < next_len; nextindex++)
-			{
-				y = chords[next_spos + CHORDHEADERLEN + nextindex * NOTELEN];
-				while (y < 0) y += VOCSIZE;
-
-				if (x == y)
-				{
-					yfound = 1;
-					break;
-				}
-			}
+   A note with pitch x in the first chord starts a match if each following chord k contains the pitch
+   x + pattern[k] - pattern[0]. This is checked for all notes of the first chord at once by bit-and of
+   the pitch sets of the chords, each shifted by the interval from the first note of the pattern.
+   Start positions of the chords in @chords are read from preprocessed data of MonoPoly (pp, with items of itemsize bytes).
+*/
+VALUE c_matchcheck(VALUE self, pitchset *pitchsets, char *pp, size_t itemsize, unsigned int chordind, vector *pattern, unsigned int pattern_size, VALUE result_list)
+{
+	VALUE zero = Qnil, matchednotes_obj[MAX_PATTERN_NOTES];
+	pitchset starts, shifted;
+	unsigned int k, w;
+	int pitch, interval;
+	uint64_t bits;
 
-			if (yfound == 1)
-			{
-				/* ynote matched: we can move to the next chord */
-				pitch = x;
-				matchednotes[pattern_index + 1] = next_spos + CHORDHEADERLEN + nextindex * NOTELEN;
-			}
-			else found = 0;
+	if (pattern_size > MAX_PATTERN_NOTES) return result_list;
 
-			/* move to the next chord */
-			current_spos += CHORDHEADERLEN + current_len * NOTELEN;
-			current_len = chords[current_spos];
-			pattern_index++;
-		}
+	/* pitches of the first chord that start a sequence matching the pattern intervals */
+	starts = pitchsets[chordind];
+	for (k = 1; k < pattern_size && (starts.w[0] | starts.w[1]); k++)
+	{
+		shifted = pitchset_shift(pitchsets[chordind + k], (int) pattern[k].ptch - (int) pattern[0].ptch);
+		starts.w[0] &= shifted.w[0];
+		starts.w[1] &= shifted.w[1];
+	}
 
-		if (found == 1)
+	/* report a match for each start pitch in ascending order */
+	for (w = 0; w < 2; w++)
+	{
+		for (bits = starts.w[w]; bits; bits &= bits - 1)
 		{
-			/* Calculates the amount of transposition from the first note of the pattern and the first matched note. */
-			/* Assumes that the algorithm is exact, which implies that all notes are transposed the same amount. */
-			transposition = chords[matchednotes[0]] - pattern[0].ptch;
-			if (zero == Qnil) zero = UINT2NUM(0);
+			pitch = w * 64 + __builtin_ctzll(bits);
 
-			/* Conversion of matched notes to object format */
-			for (i = 0; i < pattern_size; i++) matchednotes_obj[i] = UINT2NUM(matchednotes[i]);
+			/* Conversion of matched notes (positions of the notes in @chords) to object format */
+			for (k = 0; k < pattern_size; k++)
+			{
+				interval = (int) pattern[k].ptch - (int) pattern[0].ptch;
+				matchednotes_obj[k] = SIZET2NUM(pp_spos(pp, itemsize, chordind + k) + CHORDHEADERLEN + \
+					pitchset_rank(pitchsets[chordind + k], pitch + interval) * NOTELEN);
+			}
+			if (zero == Qnil) zero = UINT2NUM(0);
 
-			/* Add match to result list. */
+			/* Add match to result list. Transposition is calculated from the first note of the pattern and the first matched note. */
 			rb_ary_push(result_list, rb_ary_new3(6, self, UINT2NUM(chordind), UINT2NUM(chordind + pattern_size - 1), \
-				rb_ary_new4(pattern_index + 1, matchednotes_obj), INT2NUM(transposition), zero));
+				rb_ary_new4(pattern_size, matchednotes_obj), INT2NUM(pitch - pattern[0].ptch), zero));
 
 			/* There may be overlapping matches, so we do not stop after the first match. */
-			/* But if there are multiple overlapping matches with only the last note different, only one is found. */
-			/* -> the best match may not be reported. */
 		}
 	}
 	return result_list;
 }
-
-
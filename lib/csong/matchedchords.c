@@ -19,17 +19,21 @@
 */
 VALUE c_matchedchords(VALUE self, VALUE firstchordparam, VALUE lastchordparam)
 {
-	VALUE chordarray = Qnil, notearray = Qnil, strt;
+	volatile VALUE chords_str;
+	VALUE chordarray = Qnil, notearray = Qnil, strt, preprocessed;
 	char *chords, *s;
-	unsigned int i, j, offset, chords_size, firstchord, lastchord, chordlen = 0, spos;
+	unsigned int i, j, offset, chords_size, firstchord, lastchord, chordlen = 0;
+	size_t spos;
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	firstchord = NUM2UINT(firstchordparam);
 	lastchord = NUM2UINT(lastchordparam);
 
-	/* preprocessed string consists of (spos:4, intervaldata:2) pairs. used to get spos by chordindex */
-	s = (char *) RSTRING_PTR(rb_iv_get(self, "@preprocessed"));
+	/* preprocessed string consists of (spos, intervaldata:2) items (see song.h). used to get spos by chordindex */
+	preprocessed = rb_iv_get(self, "@preprocessed");
+	s = (char *) RSTRING_PTR(preprocessed);
 
 	/* validate chord indexes */
 	if (firstchord >= chords_size || lastchord >= chords_size) return Qnil;
@@ -38,7 +42,7 @@ VALUE c_matchedchords(VALUE self, VALUE firstchordparam, VALUE lastchordparam)
 	chordarray = rb_ary_new2(lastchord - firstchord);
 
 	/* skip chords before the first chord */
-	spos = *((unsigned int *) (s + firstchord * PP_ITEM_SIZE));
+	spos = pp_spos(s, pp_item_size(preprocessed, chords_size), firstchord);
 
 	/* strt of the first chord of the match; this is subtracted from strts 
 	 * of the notes in the match so that the times start at zero */
@@ -48,7 +52,7 @@ VALUE c_matchedchords(VALUE self, VALUE firstchordparam, VALUE lastchordparam)
 	for (i = 0; i <= lastchord - firstchord; i++)
 	{
 		/* get chord size */
-		chordlen = chords[spos];
+		chordlen = CHORDLEN(chords + spos);
 
 		/* get strt */
 		strt = UINT2NUM(*((unsigned int *) (chords + spos + 1)) - offset);
@@ -0,0 +1,622 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Native converter from Standard MIDI Files to the note data formats of Song.
+   Replaces the pipeline SMF::Sequence.decodefile -> MIDI2Chords callbacks (lib/midiconvert.rb)
+   -> Song#create_tracks_and_chords -> Song#create_turningpoints, and produces identical data.
+   The Ruby interface is in midi2chords_wrapper.c.
+
+   Compiled with -DMIDI2CHORDS_MAIN this file is also a standalone program:
+   midi2chords [-x] file.mid ... prints a summary of each file, or with -x a hex dump of the converted data.
+*/
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "midi2chords.h"
+
+
+/* Growable array of fixed size items. */
+typedef struct {
+	char *data;
+	size_t len, cap, itemsize;
+} m2cArray;
+
+
+static int m2c_push(m2cArray *a, const void *item)
+{
+	char *data;
+
+	if (a->len == a->cap)
+	{
+		a->cap = a->cap ? a->cap * 2 : 64;
+		data = (char *) realloc(a->data, a->cap * a->itemsize);
+		if (data == NULL) return M2C_ERR_MEMORY;
+		a->data = data;
+	}
+	memcpy(a->data + a->len * a->itemsize, item, a->itemsize);
+	a->len++;
+	return M2C_OK;
+}
+
+
+static int m2c_append(m2cArray *a, const char *s, size_t n)
+{
+	size_t i;
+	int err = M2C_OK;
+
+	for (i = 0; i < n && err == M2C_OK; i++) err = m2c_push(a, s + i);
+	return err;
+}
+
+
+/* names of text meta events 0x01...0x0f, as given by MIDI2Chords callbacks */
+static const char *m2c_text_names[16] = { NULL, "GeneralPurposeText", "CopyrightNotice", "TrackName", "InstrumentName", \
+	"Lyric", "Marker", "CuePoint", "ProgramName", "DeviceName", "Text0A", "Text0B", "Text0C", "Text0D", "Text0E", "Text0F" };
+
+
+/*
+   Appends a text event to metatext as MIDI2Chords#text does: "<offset> <name> <text.inspect>\n",
+   where inspect is that of a binary Ruby string.
+*/
+static int m2c_text(m2cArray *metatext, long long offset, int type, const unsigned char *text, size_t len)
+{
+	char buf[64];
+	size_t i;
+	int err;
+	unsigned char c;
+
+	snprintf(buf, sizeof(buf), "%lld %s \"", offset, m2c_text_names[type]);
+	err = m2c_append(metatext, buf, strlen(buf));
+
+	for (i = 0; i < len && err == M2C_OK; i++)
+	{
+		c = text[i];
+		switch (c)
+		{
+			case '"': err = m2c_append(metatext, "\\\"", 2); break;
+			case '\\': err = m2c_append(metatext, "\\\\", 2); break;
+			case '\n': err = m2c_append(metatext, "\\n", 2); break;
+			case '\r': err = m2c_append(metatext, "\\r", 2); break;
+			case '\t': err = m2c_append(metatext, "\\t", 2); break;
+			case '\f': err = m2c_append(metatext, "\\f", 2); break;
+			case '\v': err = m2c_append(metatext, "\\v", 2); break;
+			case '\b': err = m2c_append(metatext, "\\b", 2); break;
+			case '\a': err = m2c_append(metatext, "\\a", 2); break;
+			case 0x1b: err = m2c_append(metatext, "\\e", 2); break;
+			case '#':
+				/* escaped when it would start an interpolation */
+				if (i + 1 < len && (text[i + 1] == '{' || text[i + 1] == '$' || text[i + 1] == '@')) err = m2c_append(metatext, "\\#", 2);
+				else err = m2c_append(metatext, "#", 1);
+				break;
+			default:
+				if (c >= 0x20 && c < 0x7f) err = m2c_append(metatext, (char *) &c, 1);
+				else
+				{
+					snprintf(buf, sizeof(buf), "\\x%02X", c);
+					err = m2c_append(metatext, buf, 4);
+				}
+		}
+	}
+	if (err == M2C_OK) err = m2c_append(metatext, "\"\n", 2);
+	return err;
+}
+
+
+/* Reads a variable-length quantity at *pos. Returns -1 if the data ends. */
+static long long m2c_varlen(const unsigned char *data, size_t end, size_t *pos)
+{
+	long long value = 0;
+	int i;
+
+	for (i = 0; i < 4; i++)
+	{
+		if (*pos >= end) return -1;
+		value = (value << 7) | (data[*pos] & 0x7f);
+		if (!(data[(*pos)++] & 0x80)) return value;
+	}
+	return value;
+}
+
+
+/*
+   Parses one track chunk data[pos...end). Delta times are summed to offset as in MIDI2Chords.
+   Notes are keyed by channel and pitch over all tracks; a note on event replaces an earlier one with
+   the same key, and note off events are matched to the latest note on without removing it.
+*/
+static int m2c_read_track(const unsigned char *data, size_t pos, size_t end, int track, \
+	long long (*notes_on)[128], char (*notes_on_set)[128], m2cArray *notes, m2cArray *timesigs, m2cArray *keysigs, m2cArray *metatext)
+{
+	long long offset = 0, delta, len, item[5];
+	int status = 0, type, ch, ptch, vel, err = M2C_OK;
+	unsigned int i;
+	m2cNote note;
+
+	while (pos < end && err == M2C_OK)
+	{
+		if ((delta = m2c_varlen(data, end, &pos)) < 0) return M2C_ERR_TRUNCATED;
+		offset += delta;
+		if (pos >= end) return M2C_ERR_TRUNCATED;
+
+		/* running status applies to channel messages only */
+		if (data[pos] & 0x80) status = data[pos++];
+		else if (status < 0x80 || status >= 0xf0) return M2C_ERR_FORMAT;
+
+		if (status == 0xff)
+		{
+			/* meta event */
+			if (pos >= end) return M2C_ERR_TRUNCATED;
+			type = data[pos++];
+			if ((len = m2c_varlen(data, end, &pos)) < 0 || pos + len > end) return M2C_ERR_TRUNCATED;
+
+			if (type == 0x2f) break;
+			else if (type >= 0x01 && type <= 0x0f) err = m2c_text(metatext, offset, type, data + pos, len);
+			else if (type == 0x58 && len >= 4)
+			{
+				/* time signatures with the same offset are stored only once */
+				for (i = 0; i < timesigs->len; i++) if (((long long *) timesigs->data)[5 * i] == offset) break;
+				if (i == timesigs->len)
+				{
+					item[0] = offset; item[1] = data[pos]; item[2] = data[pos + 1]; item[3] = data[pos + 2]; item[4] = data[pos + 3];
+					err = m2c_push(timesigs, item);
+				}
+			}
+			else if (type == 0x59 && len >= 2)
+			{
+				item[0] = offset; item[1] = (signed char) data[pos]; item[2] = data[pos + 1];
+				err = m2c_push(keysigs, item);
+			}
+			pos += len;
+			status = 0;
+		}
+		else if (status == 0xf0 || status == 0xf7)
+		{
+			/* system exclusive event */
+			if ((len = m2c_varlen(data, end, &pos)) < 0 || pos + len > end) return M2C_ERR_TRUNCATED;
+			pos += len;
+			status = 0;
+		}
+		else
+		{
+			/* channel message; program change and channel pressure have one data byte */
+			type = status & 0xf0;
+			ch = status & 0x0f;
+			len = (type == 0xc0 || type == 0xd0) ? 1 : 2;
+			if (pos + len > end) return M2C_ERR_TRUNCATED;
+			ptch = data[pos] & 0x7f;
+			vel = len > 1 ? data[pos + 1] & 0x7f : 0;
+			pos += len;
+
+			if (type == 0x90 && vel > 0)
+			{
+				notes_on[ch][ptch] = offset;
+				notes_on_set[ch][ptch] = 1;
+			}
+			else if ((type == 0x80 || type == 0x90) && notes_on_set[ch][ptch])
+			{
+				note.strt = notes_on[ch][ptch];
+				note.dur = offset - note.strt;
+				note.ptch = ptch;
+				note.track = track;
+				note.chordind = 0;
+				err = m2c_push(notes, &note);
+			}
+			/* note off events without a corresponding note on event are ignored */
+		}
+	}
+	return err;
+}
+
+
+/*
+   Reads a Standard MIDI File to song: header data, signatures, metatexts and notes.
+   Call m2c_convert to create the note data formats.
+*/
+int m2c_read_file(const char *path, m2cSong *song)
+{
+	FILE *f;
+	unsigned char *data;
+	size_t size, pos, len;
+	long fsize;
+	int track = -1, err = M2C_OK;
+	long long (*notes_on)[128];
+	char (*notes_on_set)[128];
+	m2cArray notes = { NULL, 0, 0, sizeof(m2cNote) }, timesigs = { NULL, 0, 0, 5 * sizeof(long long) };
+	m2cArray keysigs = { NULL, 0, 0, 3 * sizeof(long long) }, metatext = { NULL, 0, 0, 1 };
+
+	memset(song, 0, sizeof(m2cSong));
+
+	if ((f = fopen(path, "rb")) == NULL) return M2C_ERR_OPEN;
+	fseek(f, 0, SEEK_END);
+	fsize = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	if (fsize < 0 || (data = (unsigned char *) malloc(fsize + 1)) == NULL) { fclose(f); return M2C_ERR_MEMORY; }
+	size = fread(data, 1, fsize, f);
+	fclose(f);
+
+	/* header chunk */
+	if (size < 14 || memcmp(data, "MThd", 4) != 0) { free(data); return M2C_ERR_FORMAT; }
+	len = ((size_t) data[4] << 24) | (data[5] << 16) | (data[6] << 8) | data[7];
+	song->format = (data[8] << 8) | data[9];
+	song->num_tracks = (data[10] << 8) | data[11];
+	song->division = (data[12] << 8) | data[13];
+
+	/* SMPTE based division: use ticks per frame */
+	if (song->division & 0x8000) song->division &= 0xff;
+
+	/* start times of sounding notes by channel and pitch; allocated, as converters may run on threads with small stacks */
+	notes_on = (long long (*)[128]) malloc(16 * sizeof(*notes_on));
+	notes_on_set = (char (*)[128]) calloc(16, sizeof(*notes_on_set));
+	if (!notes_on || !notes_on_set) { free(notes_on); free(notes_on_set); free(data); return M2C_ERR_MEMORY; }
+
+	/* track chunks; other chunks are skipped */
+	for (pos = 8 + len; pos + 8 <= size && err == M2C_OK; pos += len)
+	{
+		len = ((size_t) data[pos + 4] << 24) | (data[pos + 5] << 16) | (data[pos + 6] << 8) | data[pos + 7];
+		pos += 8;
+		if (pos + len > size) err = M2C_ERR_TRUNCATED;
+		else if (memcmp(data + pos - 8, "MTrk", 4) == 0)
+		{
+			track++;
+			err = m2c_read_track(data, pos, pos + len, track, notes_on, notes_on_set, &notes, &timesigs, &keysigs, &metatext);
+		}
+	}
+	free(notes_on);
+	free(notes_on_set);
+	free(data);
+
+	song->notes = (m2cNote *) notes.data;
+	song->num_notes_raw = notes.len;
+	song->timesignatures = (long long *) timesigs.data;
+	song->num_timesignatures = timesigs.len;
+	song->keysignatures = (long long *) keysigs.data;
+	song->num_keysignatures = keysigs.len;
+	song->metatext = metatext.data;
+	song->metatext_len = metatext.len;
+
+	if (err != M2C_OK) m2c_free(song);
+	return err;
+}
+
+
+/*
+   Notes are sorted by start time and pitch as in Song#create_tracks_and_chords.
+   Duration and track break ties, so that the order is fully determined.
+*/
+static int m2c_note_cmp(const void *a, const void *b)
+{
+	const m2cNote *x = (const m2cNote *) a, *y = (const m2cNote *) b;
+
+	if (x->strt != y->strt) return x->strt < y->strt ? -1 : 1;
+	if (x->ptch != y->ptch) return x->ptch < y->ptch ? -1 : 1;
+	if (x->dur != y->dur) return x->dur < y->dur ? -1 : 1;
+	if (x->track != y->track) return x->track < y->track ? -1 : 1;
+	return 0;
+}
+
+
+/* A note of P3 after merging overlapping notes with the same pitch; next is the following merged note with the same pitch. */
+typedef struct {
+	long long strt, endp;
+	int ptch, next;
+	unsigned int chordind;
+} m2cMergedNote;
+
+
+/* Restores the heap order of merged notes heap[0...size - 1] by end point and pitch, starting from position i. */
+static void m2c_sift_down(const m2cMergedNote *merged, int *heap, int size, int i)
+{
+	int child, top = heap[i];
+
+	for (; (child = 2 * i + 1) < size; i = child)
+	{
+		if (child + 1 < size && (merged[heap[child + 1]].endp < merged[heap[child]].endp || \
+			(merged[heap[child + 1]].endp == merged[heap[child]].endp && merged[heap[child + 1]].ptch < merged[heap[child]].ptch))) child++;
+		if (merged[top].endp < merged[heap[child]].endp || (merged[top].endp == merged[heap[child]].endp && merged[top].ptch < merged[heap[child]].ptch)) break;
+		heap[i] = heap[child];
+	}
+	heap[i] = top;
+}
+
+
+/*
+   Creates P3 turning points as Song#create_turningpoints did: overlapping notes with the same pitch are merged,
+   and both turning points of a merged note get the chord index of the last overlapping note. Notes must be sorted
+   by onset time and pitch. Returns (time, pitch, chord index) triples of the start and end points, sorted by time 
+   and pitch, in malloc'd arrays.
+
+   Merged notes start in the order of the notes, so start points are already sorted. End points of each pitch are
+   in time order, so end points are sorted by merging the pitches with a heap instead of sorting.
+*/
+int m2c_create_turningpoints(const m2cNote *notes, size_t num_notes, unsigned int **startpoints, unsigned int **endpoints, size_t *num_turningpoints)
+{
+	m2cMergedNote *merged;
+	int on[128], first[128], heap[128], heapsize = 0, k, ptch;
+	unsigned int *sp, *ep;
+	long long endp;
+	size_t i, n = 0;
+
+	merged = (m2cMergedNote *) malloc((num_notes + 1) * sizeof(m2cMergedNote));
+	sp = *startpoints = (unsigned int *) malloc((num_notes + 1) * 3 * sizeof(unsigned int));
+	ep = *endpoints = (unsigned int *) malloc((num_notes + 1) * 3 * sizeof(unsigned int));
+	if (!merged || !sp || !ep) { free(merged); free(sp); free(ep); *startpoints = *endpoints = NULL; return M2C_ERR_MEMORY; }
+
+	for (ptch = 0; ptch < 128; ptch++) on[ptch] = first[ptch] = -1;
+
+	for (i = 0; i < num_notes; i++)
+	{
+		ptch = notes[i].ptch & 127;
+		endp = notes[i].strt + notes[i].dur;
+		k = on[ptch];
+
+		if (k >= 0 && notes[i].strt <= merged[k].endp)
+		{
+			/* overlaps with the note that is on: update end point and end chord index */
+			if (endp > merged[k].endp) { merged[k].endp = endp; merged[k].chordind = notes[i].chordind; }
+			continue;
+		}
+
+		/* the last note of this pitch ended before this note started */
+		merged[n].strt = notes[i].strt;
+		merged[n].endp = endp;
+		merged[n].ptch = ptch;
+		merged[n].chordind = notes[i].chordind;
+		merged[n].next = -1;
+		if (k >= 0) merged[k].next = n; else first[ptch] = n;
+		on[ptch] = n++;
+	}
+
+	/* all values are unsigned ints */
+	for (i = 0; i < n; i++, sp += 3)
+	{
+		sp[0] = (unsigned int) merged[i].strt;
+		sp[1] = merged[i].ptch;
+		sp[2] = merged[i].chordind;
+	}
+
+	/* merge the end points of all pitches */
+	for (ptch = 0; ptch < 128; ptch++) if (first[ptch] >= 0) heap[heapsize++] = first[ptch];
+	for (k = heapsize / 2 - 1; k >= 0; k--) m2c_sift_down(merged, heap, heapsize, k);
+	while (heapsize > 0)
+	{
+		k = heap[0];
+		ep[0] = (unsigned int) merged[k].endp;
+		ep[1] = merged[k].ptch;
+		ep[2] = merged[k].chordind;
+		ep += 3;
+
+		if (merged[k].next >= 0) heap[0] = merged[k].next;
+		else heap[0] = heap[--heapsize];
+		if (heapsize > 0) m2c_sift_down(merged, heap, heapsize, 0);
+	}
+
+	*num_turningpoints = n;
+	free(merged);
+	return M2C_OK;
+}
+
+
+static int m2c_turningpoints(m2cSong *song)
+{
+	return m2c_create_turningpoints(song->notes, song->num_notes_raw, &song->p3_startpoints, &song->p3_endpoints, &song->num_turningpoints);
+}
+
+
+/*
+   Creates chords, tracks, compacted tracks and P3 turning points from the notes read by m2c_read_file.
+   Follows Song#create_tracks_and_chords: in each chord, a track gets its highest note, and of notes with
+   the same pitch only one (the last in sorted order) is stored in chords.
+   The song must have at least one note.
+*/
+int m2c_convert(m2cSong *song)
+{
+	size_t i, first, last, n, cpos;
+	unsigned int k, rowlen, chordind, kept, num_chords = 1, offset;
+	int prevptch, tr;
+	unsigned char *row, *chord;
+	uint32_t strt;
+	uint16_t dur;
+
+	qsort(song->notes, song->num_notes_raw, sizeof(m2cNote), m2c_note_cmp);
+
+	/* count chords to size the track matrix */
+	for (i = 1; i < song->num_notes_raw; i++) if (song->notes[i].strt != song->notes[i - 1].strt) num_chords++;
+
+	rowlen = num_chords + 1;
+	song->tracks = (unsigned char *) malloc((size_t) song->num_tracks * rowlen + 1);
+	song->tracklengths = (unsigned int *) calloc(song->num_tracks + 1, sizeof(unsigned int));
+
+	/* each note takes 4 bytes and each chord a header of 5 bytes; pseudo infinity chord takes 9 */
+	song->chords = (unsigned char *) malloc(song->num_notes_raw * 4 + (size_t) num_chords * 5 + 9);
+	if (!song->tracks || !song->tracklengths || !song->chords) return M2C_ERR_MEMORY;
+
+	for (k = 0; k < (unsigned int) song->num_tracks; k++) song->tracks[(size_t) k * rowlen] = ' ';
+
+	for (cpos = 0, chordind = 0, first = 0; first < song->num_notes_raw; first = last, chordind++)
+	{
+		for (last = first; last < song->num_notes_raw && song->notes[last].strt == song->notes[first].strt; last++) song->notes[last].chordind = chordind;
+
+		n = last - first;
+		song->num_notes_with_duplicates += n;
+		if (n > song->maxpoly_with_duplicates) song->maxpoly_with_duplicates = n;
+
+		/* reverse order: add highest note only to discard polyphonicity inside tracks */
+		for (i = last; i-- > first; )
+		{
+			tr = song->notes[i].track + 1;
+			if (tr < 1 || tr > song->num_tracks) return M2C_ERR_TRACK;
+			if (song->tracklengths[tr] < chordind + 1)
+			{
+				song->tracks[(size_t) (tr - 1) * rowlen + chordind + 1] = song->notes[i].ptch;
+				song->tracklengths[tr]++;
+			}
+		}
+
+		/* put null symbols to other tracks */
+		for (k = 1; k <= (unsigned int) song->num_tracks; k++)
+		{
+			if (song->tracklengths[k] < chordind + 1)
+			{
+				song->tracks[(size_t) (k - 1) * rowlen + chordind + 1] = 255;
+				song->tracklengths[k]++;
+			}
+		}
+
+		/* count notes with no duplicates: of equal pitches, the last one is kept */
+		for (kept = 0, prevptch = -1, i = last; i-- > first; )
+		{
+			if (song->notes[i].ptch != prevptch) { kept++; prevptch = song->notes[i].ptch; }
+		}
+		if (kept > song->maxpoly) song->maxpoly = kept;
+		song->num_notes += kept;
+
+		/* chord header: chordlen and strt */
+		chord = song->chords + cpos;
+		chord[0] = kept;
+		strt = (uint32_t) song->notes[first].strt;
+		memcpy(chord + 1, &strt, 4);
+		cpos += 5;
+
+		/* notes in ascending order of pitch: pitch, duration and track */
+		for (i = first; i < last; i++)
+		{
+			if (i + 1 < last && song->notes[i + 1].ptch == song->notes[i].ptch) continue;
+			song->chords[cpos] = song->notes[i].ptch;
+			dur = (uint16_t) song->notes[i].dur;
+			memcpy(song->chords + cpos + 1, &dur, 2);
+			song->chords[cpos + 3] = (unsigned char) song->notes[i].track;
+			cpos += 4;
+		}
+	}
+	song->num_chords = num_chords;
+
+	/* Add pseudo infinity value to the end of chords for geometric algorithms */
+	song->chords[cpos] = 1;
+	strt = 4294967295U;
+	memcpy(song->chords + cpos + 1, &strt, 4);
+	song->chords[cpos + 5] = 127;
+	dur = 65535;
+	memcpy(song->chords + cpos + 6, &dur, 2);
+	song->chords[cpos + 8] = 127;
+	song->chords_len = cpos + 9;
+
+	/* gap-free tracks; each starts with an unused position */
+	song->compacted_tracks = (unsigned char *) malloc((size_t) song->num_tracks + song->num_notes_raw + 1);
+	song->compacted_mappings = (unsigned int *) malloc(((size_t) song->num_tracks + song->num_notes_raw + 1) * sizeof(unsigned int));
+	song->compacted_offsets = (unsigned int *) malloc((song->num_tracks + 1) * sizeof(unsigned int));
+	if (!song->compacted_tracks || !song->compacted_mappings || !song->compacted_offsets) return M2C_ERR_MEMORY;
+
+	song->compacted_offsets[0] = offset = 0;
+	for (k = 1; k <= (unsigned int) song->num_tracks; k++)
+	{
+		row = song->tracks + (size_t) (k - 1) * rowlen;
+		song->compacted_tracks[offset] = 0;
+		song->compacted_mappings[offset++] = 0;
+		for (chordind = 1; chordind <= num_chords; chordind++)
+		{
+			if (row[chordind] == 255) continue;
+			song->compacted_tracks[offset] = row[chordind];
+			song->compacted_mappings[offset++] = chordind;
+		}
+		song->compacted_offsets[k] = offset;
+	}
+	song->compacted_len = offset;
+
+	return m2c_turningpoints(song);
+}
+
+
+void m2c_free(m2cSong *song)
+{
+	free(song->timesignatures);
+	free(song->keysignatures);
+	free(song->metatext);
+	free(song->notes);
+	free(song->chords);
+	free(song->tracks);
+	free(song->tracklengths);
+	free(song->compacted_tracks);
+	free(song->compacted_mappings);
+	free(song->compacted_offsets);
+	free(song->p3_startpoints);
+	free(song->p3_endpoints);
+	memset(song, 0, sizeof(m2cSong));
+}
+
+
+const char *m2c_error(int code)
+{
+	switch (code)
+	{
+		case M2C_OK: return "no error";
+		case M2C_ERR_OPEN: return "cannot open file";
+		case M2C_ERR_FORMAT: return "not a standard MIDI file";
+		case M2C_ERR_TRUNCATED: return "truncated MIDI file";
+		case M2C_ERR_TRACK: return "note on a track not declared in the header";
+		case M2C_ERR_MEMORY: return "out of memory";
+	}
+	return "unknown error";
+}
+
+
+#ifdef MIDI2CHORDS_MAIN
+
+static void m2c_hexdump(const char *name, const void *data, size_t len)
+{
+	size_t i;
+
+	printf("%s %lu\n", name, (unsigned long) len);
+	for (i = 0; i < len; i++) printf("%02x%s", ((const unsigned char *) data)[i], (i % 32 == 31 || i == len - 1) ? "\n" : "");
+}
+
+
+int main(int argc, char **argv)
+{
+	m2cSong song;
+	int i, err, dump = 0, status = 0;
+
+	if (argc > 1 && strcmp(argv[1], "-x") == 0) { dump = 1; argv++; argc--; }
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: midi2chords [-x] file.mid ...\n");
+		return 2;
+	}
+
+	for (i = 1; i < argc; i++)
+	{
+		if ((err = m2c_read_file(argv[i], &song)) == M2C_OK && song.num_notes_raw > 0) err = m2c_convert(&song);
+		if (err != M2C_OK)
+		{
+			fprintf(stderr, "Error: skipping file %s: %s\n", argv[i], m2c_error(err));
+			m2c_free(&song);
+			status = 1;
+			continue;
+		}
+
+		printf("%s: tracks=%d chords=%u notes=%u notes_with_duplicates=%u maxpoly=%u turningpoints=%lu\n", argv[i], \
+			song.num_tracks, song.num_chords, song.num_notes, song.num_notes_with_duplicates, song.maxpoly, (unsigned long) song.num_turningpoints);
+
+		if (dump && song.num_notes_raw > 0)
+		{
+			m2c_hexdump("chords", song.chords, song.chords_len);
+			m2c_hexdump("tracks", song.tracks, (size_t) song.num_tracks * (song.num_chords + 1));
+			m2c_hexdump("compacted_tracks", song.compacted_tracks, song.compacted_len);
+			m2c_hexdump("compacted_mappings", song.compacted_mappings, song.compacted_len * sizeof(unsigned int));
+			m2c_hexdump("compacted_offsets", song.compacted_offsets, (song.num_tracks + 1) * sizeof(unsigned int));
+			m2c_hexdump("p3_startpoints", song.p3_startpoints, song.num_turningpoints * 3 * sizeof(unsigned int));
+			m2c_hexdump("p3_endpoints", song.p3_endpoints, song.num_turningpoints * 3 * sizeof(unsigned int));
+			m2c_hexdump("metatext", song.metatext, song.metatext_len);
+		}
+		m2c_free(&song);
+	}
+	return status;
+}
+
+#endif
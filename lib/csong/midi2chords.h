@@ -0,0 +1,72 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Native converter from Standard MIDI Files to the note data formats of Song.
+   Does not depend on Ruby, so that it can be used also as a standalone program.
+*/
+
+#ifndef MIDI2CHORDS_H
+#define MIDI2CHORDS_H
+
+#include <stddef.h>
+
+/* error codes returned by m2c_read_file and m2c_convert */
+#define M2C_OK 0
+#define M2C_ERR_OPEN 1
+#define M2C_ERR_FORMAT 2
+#define M2C_ERR_TRUNCATED 3
+#define M2C_ERR_TRACK 5
+#define M2C_ERR_MEMORY 6
+
+
+/* A note: onset time, duration (both in MIDI ticks), pitch, index of the MIDI track and index of the chord. */
+typedef struct {
+	long long strt;
+	long long dur;
+	int ptch;
+	int track;
+	unsigned int chordind;
+} m2cNote;
+
+
+/*
+   Converted song. Fields correspond to instance variables of Song, and byte strings have the same format;
+   see lib/song.rb for descriptions.
+*/
+typedef struct {
+	/* from the MIDI file */
+	int format, num_tracks, division;
+	long long *timesignatures;		/* [offset, nn, dd, cc, bb] for each time signature */
+	long long *keysignatures;		/* [offset, sf, mi] for each key signature */
+	unsigned int num_timesignatures, num_keysignatures;
+	char *metatext;
+	size_t metatext_len;
+	m2cNote *notes;
+	size_t num_notes_raw;
+
+	/* created by m2c_convert */
+	unsigned char *chords;
+	size_t chords_len;
+	unsigned int num_chords, num_notes, num_notes_with_duplicates, maxpoly, maxpoly_with_duplicates;
+	unsigned char *tracks;			/* track matrix, num_tracks rows of num_chords + 1 bytes */
+	unsigned int *tracklengths;		/* indexes 1...num_tracks */
+	unsigned char *compacted_tracks;
+	unsigned int *compacted_mappings, *compacted_offsets;
+	size_t compacted_len;
+	unsigned int *p3_startpoints, *p3_endpoints;	/* (time, pitch, chord index) triples */
+	size_t num_turningpoints;
+} m2cSong;
+
+
+int m2c_read_file(const char *path, m2cSong *song);
+int m2c_convert(m2cSong *song);
+void m2c_free(m2cSong *song);
+const char *m2c_error(int code);
+int m2c_create_turningpoints(const m2cNote *notes, size_t num_notes, unsigned int **startpoints, unsigned int **endpoints, size_t *num_turningpoints);
+
+#endif
@@ -0,0 +1,125 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Ruby interface of the native MIDI converter in midi2chords.c.
+*/
+
+
+#include "song.h"
+#include "midi2chords.h"
+
+extern VALUE cSong;
+
+
+/* Returns an array of arrays of n integers each. */
+static VALUE m2c_int_arrays(long long *items, unsigned int count, int n)
+{
+	VALUE list, item;
+	unsigned int i;
+	int j;
+
+	list = rb_ary_new();
+	for (i = 0; i < count; i++)
+	{
+		item = rb_ary_new();
+		for (j = 0; j < n; j++) rb_ary_push(item, LL2NUM(items[i * n + j]));
+		rb_ary_push(list, item);
+	}
+	return list;
+}
+
+
+/*
+   Converts a MIDI file to a Song object. Returns nil if the file has no notes, and raises an exception
+   if the file cannot be read. Sets the same instance variables as SMF::Sequence#convert and Song.new,
+   in the same order, except that @metatext is not compressed, and @primes and MonoPoly preprocessing are left
+   to Song#complete_native_conversion. Use Song.from_midifile.
+*/
+VALUE c_read_midifile(VALUE self, VALUE path)
+{
+	VALUE song_obj, tracklengths;
+	m2cSong song;
+	unsigned int k;
+	int err;
+
+	if ((err = m2c_read_file(StringValueCStr(path), &song)) != M2C_OK) rb_raise(rb_eRuntimeError, "%s", m2c_error(err));
+	if (song.num_notes_raw == 0) { m2c_free(&song); return Qnil; }
+	if ((err = m2c_convert(&song)) != M2C_OK) { m2c_free(&song); rb_raise(rb_eRuntimeError, "%s", m2c_error(err)); }
+
+	song_obj = rb_obj_alloc(cSong);
+
+	tracklengths = rb_ary_new();
+	rb_ary_push(tracklengths, Qnil);
+	for (k = 1; k <= (unsigned int) song.num_tracks; k++) rb_ary_push(tracklengths, UINT2NUM(song.tracklengths[k]));
+
+	rb_iv_set(song_obj, "@chords", rb_str_new((char *) song.chords, song.chords_len));
+	rb_iv_set(song_obj, "@num_chords", UINT2NUM(song.num_chords));
+	rb_iv_set(song_obj, "@tracklengths", tracklengths);
+	rb_iv_set(song_obj, "@max_tracklength", INT2FIX(0));
+	rb_iv_set(song_obj, "@num_notes", UINT2NUM(song.num_notes));
+	rb_iv_set(song_obj, "@num_notes_with_duplicates", UINT2NUM(song.num_notes_with_duplicates));
+	rb_iv_set(song_obj, "@preprocessed", Qnil);
+	rb_iv_set(song_obj, "@maxpoly", UINT2NUM(song.maxpoly));
+	rb_iv_set(song_obj, "@maxpoly_with_duplicates", UINT2NUM(song.maxpoly_with_duplicates));
+	rb_iv_set(song_obj, "@primes", rb_ary_new());
+	rb_iv_set(song_obj, "@quarternoteduration", INT2NUM(song.division));
+	rb_iv_set(song_obj, "@timesignatures", m2c_int_arrays(song.timesignatures, song.num_timesignatures, 5));
+	rb_iv_set(song_obj, "@keysignatures", m2c_int_arrays(song.keysignatures, song.num_keysignatures, 3));
+	rb_iv_set(song_obj, "@num_tracks", INT2NUM(song.num_tracks));
+	rb_iv_set(song_obj, "@division", INT2NUM(song.division));
+	rb_iv_set(song_obj, "@metatext", rb_str_new(song.metatext, song.metatext_len));
+	rb_iv_set(song_obj, "@tracks", rb_str_new((char *) song.tracks, (size_t) song.num_tracks * (song.num_chords + 1)));
+	rb_iv_set(song_obj, "@compacted_tracks", rb_str_new((char *) song.compacted_tracks, song.compacted_len));
+	rb_iv_set(song_obj, "@compacted_mappings", rb_str_new((char *) song.compacted_mappings, song.compacted_len * sizeof(unsigned int)));
+	rb_iv_set(song_obj, "@compacted_offsets", rb_str_new((char *) song.compacted_offsets, (song.num_tracks + 1) * sizeof(unsigned int)));
+	rb_iv_set(song_obj, "@preprocessed_p3_startpoints", rb_str_new((char *) song.p3_startpoints, song.num_turningpoints * 3 * sizeof(unsigned int)));
+	rb_iv_set(song_obj, "@preprocessed_p3_endpoints", rb_str_new((char *) song.p3_endpoints, song.num_turningpoints * 3 * sizeof(unsigned int)));
+	rb_iv_set(song_obj, "@preprocessed_p3_num_turningpoints", UINT2NUM(song.num_turningpoints));
+
+	m2c_free(&song);
+	return song_obj;
+}
+
+
+/*
+   Creates the P3 turning points (@preprocessed_p3_startpoints, @preprocessed_p3_endpoints and 
+   @preprocessed_p3_num_turningpoints) from the notes of Song#create_tracks_and_chords: [strt, ptch, dur, track, chordind]
+   arrays sorted by onset time and pitch.
+*/
+VALUE c_create_turningpoints(VALUE self, VALUE notes)
+{
+	m2cNote *n;
+	VALUE note;
+	unsigned int *startpoints, *endpoints;
+	size_t num_turningpoints;
+	long i, len;
+	int err;
+
+	Check_Type(notes, T_ARRAY);
+	len = RARRAY_LEN(notes);
+	n = ALLOC_N(m2cNote, len + 1);
+	for (i = 0; i < len; i++)
+	{
+		note = rb_ary_entry(notes, i);
+		n[i].strt = NUM2LL(rb_ary_entry(note, 0));
+		n[i].ptch = NUM2INT(rb_ary_entry(note, 1));
+		n[i].dur = NUM2LL(rb_ary_entry(note, 2));
+		n[i].track = NUM2INT(rb_ary_entry(note, 3));
+		n[i].chordind = NUM2UINT(rb_ary_entry(note, 4));
+	}
+	err = m2c_create_turningpoints(n, len, &startpoints, &endpoints, &num_turningpoints);
+	xfree(n);
+	if (err != M2C_OK) rb_raise(rb_eNoMemError, "%s", m2c_error(err));
+
+	rb_iv_set(self, "@preprocessed_p3_startpoints", rb_str_new((char *) startpoints, num_turningpoints * 3 * sizeof(unsigned int)));
+	rb_iv_set(self, "@preprocessed_p3_endpoints", rb_str_new((char *) endpoints, num_turningpoints * 3 * sizeof(unsigned int)));
+	rb_iv_set(self, "@preprocessed_p3_num_turningpoints", SIZET2NUM(num_turningpoints));
+	free(startpoints);
+	free(endpoints);
+	return self;
+}
@@ -17,65 +17,70 @@
 
 #include "song.h"
 
-VALUE c_matchcheck(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, VALUE result_list);
-VALUE c_matchcheck_oe(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, VALUE result_list);
-VALUE c_polycheck(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, unsigned int pattern_notes, VALUE result_list);
+VALUE c_matchcheck(VALUE self, pitchset *pitchsets, char *pp, size_t itemsize, unsigned int chordind, vector *pattern, unsigned int pattern_size, VALUE result_list);
+VALUE c_polycheck(VALUE self, pitchset *pitchsets, unsigned int chordind, pitchset *pattern_pitchsets, unsigned int pattern_size, VALUE result_list);
+
+/* number of candidates collected by the filter before they are checked */
+#define MONOPOLY_BATCH 256
 
 /*
    Pattern preprocessing and internal data structure initialization. 
    Stores data structures in init_info instance that is given as a parameter.
-   Builds table t in linear time using arrays itable and ltable. 
+   Builds table t in linear time using array ltable. 
    Array t has a column for every possible interval combination.
    Consult the article for details. 
+
+   Tables depend only on the intervals of the pattern, so they are cached by transposition-normalised pattern.
 */
 VALUE c_monopoly_init(VALUE self, VALUE init_info)
 {
-	unsigned int i, j = 0, itable[VOCSIZE], ltable[VOCSIZE], ones, e, em, mask, pattern_size, *t, tlen;
+	unsigned int i, j, ltable[VOCSIZE], ones, e, em, mask, pattern_size, *t, tlen;
 	int ii;
 	vector *pattern;
+	VALUE key, t_str;
 
 	pattern = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_monophonic_vector"));
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
+
+	key = pattern_cache_key(PC_MONOPOLY, pattern, pattern_size, 1);
+	if (pattern_cache_fetch(PC_MONOPOLY, key, init_info)) return init_info;
 	
 	/* calculate values */
-	e = pow(2, pattern_size - 1) - 1;
-	em = ~0 - pow(2, pattern_size - 2);
-	ones = pow(2, VOCSIZE) - 1;
-	mask = pow(2, pattern_size) - 1;
+	e = BIT((int) pattern_size - 1) - 1;
+	em = ~0U - BIT((int) pattern_size - 2);
+	ones = LOWBITS(VOCSIZE);
+	mask = LOWBITS(pattern_size);
 
-	/* create and initialize array t */
-	tlen = pow(2, VOCSIZE);
-	t = (unsigned int *) ALLOCA_N(unsigned int, tlen);
-	for (i = 0; i < tlen; i++) t[i] = mask;
+	/* build ltable */
+	for (i = 0; i < VOCSIZE; i++) ltable[i] = e;
 
-	/* build itable and ltable */
-	for (i = 0; i < VOCSIZE; i++)
-	{
-		itable[i] = ones - pow(2, i);
-		ltable[i] = e;
-	}
-
-	for (i = 0; i < pattern_size - 1; i++)
+	for (i = 0; i + 1 < pattern_size; i++)
 	{
 		ii = (pattern[i + 1].ptch - pattern[i].ptch) % VOCSIZE;
 		while (ii < 0) ii += VOCSIZE;
-		ltable[ii] -= pow(2, i);
+		ltable[ii] -= BIT((int) i);
 	}
 
-	/* build t */
-	for (i = 0; i < ones; i++)
+	/* build t. column i of t is the bit-and of ltable[j] over intervals j that are not present in i (bit j of i is zero). */
+	/* t[ones ^ z] is the bit-and of ltable[j] over bits j set in z; each one is obtained from z with its lowest bit cleared. */
+	/* t is built in place in the result string, so that no 16 kB table is needed on the stack. */
+	tlen = 1 << VOCSIZE;
+	t_str = rb_str_new(NULL, tlen * sizeof(unsigned int));
+	t = (unsigned int *) RSTRING_PTR(t_str);
+
+	t[ones] = mask;
+	for (i = 1; i < tlen; i++)
 	{
-		for (j = 0; j < VOCSIZE; j++)
-		{
-			if ((itable[j] | i) == itable[j]) t[i] &= ltable[j];
-		}
+		for (j = 0; !(i & (1U << j)); j++);
+		t[ones ^ i] = t[ones ^ (i & (i - 1))] & ltable[j];
 	}
 
 	/* save results to instance variables */
-	rb_iv_set(init_info, "@t", rb_str_new((char *) t, tlen * sizeof(unsigned int)));
+	rb_iv_set(init_info, "@t", t_str);
 	rb_iv_set(init_info, "@e", UINT2NUM(e));
 	rb_iv_set(init_info, "@em", UINT2NUM(em));
 	rb_iv_set(init_info, "@mask", UINT2NUM(mask));
+	pattern_cache_store(PC_MONOPOLY, key, init_info);
 	return init_info;
 }
 
@@ -90,22 +95,24 @@ VALUE c_monopoly_init(VALUE self, VALUE init_info)
    Compare also with the scanning phase of ShiftOrAnd algorithm. 
 
    Because this is a filtering algorithm, it calls either matchcheck or polycheck functions
-   to check the candidate matches. 
+   to check the candidate matches. Candidates are collected from the filter loop and checked
+   in batches of MONOPOLY_BATCH using the pitch sets of the chords.
 */
 VALUE c_monopoly_scan(VALUE self, VALUE init_info)
 {
-	VALUE results = Qnil, result_list = Qnil;
-	unsigned int e, em, mask, chordind, chords_size, pattern_size, pattern_notes, *t;
-	unsigned short int *usptr;
-	char *s, *chords, checkfunc;
-	vector *pattern_mono, *pattern_poly;
+	VALUE result_list = Qnil;
+	unsigned int e, em, mask, chordind, chords_size, pattern_size, *t, i, num_candidates = 0, candidates[MONOPOLY_BATCH];
+	VALUE preprocessed;
+	size_t itemsize;
+	char *pp, checkfunc;
+	vector *pattern_mono;
+	pitchset *pitchsets, *pattern_pitchsets;
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
+	pitchsets = (pitchset *) RSTRING_PTR(rb_iv_get(self, "@pitchsets"));
 	pattern_mono = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_monophonic_vector"));
-	pattern_poly = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_polyphonic_vector"));
+	pattern_pitchsets = (pitchset *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_pitchsets"));
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
-	pattern_notes = NUM2UINT(rb_iv_get(init_info, "@pattern_notes"));
 
 	if (chords_size < pattern_size) return Qnil;
 
@@ -117,29 +124,26 @@ VALUE c_monopoly_scan(VALUE self, VALUE init_info)
 	checkfunc = NUM2CHR(rb_iv_get(init_info, "@checkingfunction"));
 	result_list = rb_iv_get(init_info, "@matches");
 
-	/* preprocessed string consists of (spos:4, intervaldata:2) pairs */
-	s = (char *) RSTRING_PTR(rb_iv_get(self, "@preprocessed"));
+	/* preprocessed string consists of (spos, intervaldata:2) items; see song.h */
+	preprocessed = rb_iv_get(self, "@preprocessed");
+	pp = (char *) RSTRING_PTR(preprocessed);
+	itemsize = pp_item_size(preprocessed, chords_size);
 
-	for (chordind = 0; chordind < chords_size - 1; chordind++, s += PP_ITEM_SIZE)
+	for (chordind = 0; chordind < chords_size - 1; chordind++)
 	{
-		/* get a pointer to the interval data in s */
-		usptr = (unsigned short int *) (s + sizeof(unsigned int));
+		e = ((e << 1) | t[pp_intervals(pp, itemsize, chordind)]) & mask;
 
-		e = ((e << 1) | t[ *usptr ]) & mask;
+		/* collect the first chord of the candidate; check when the batch is full or at the end */
+		if ((e | em) == em) candidates[num_candidates++] = chordind - pattern_size + 2;
 
-		if ((e | em) == em)
+		if (num_candidates == MONOPOLY_BATCH || (num_candidates > 0 && chordind == chords_size - 2))
 		{
-			if (checkfunc == 1)
+			for (i = 0; i < num_candidates; i++)
 			{
-				results = c_polycheck(self, chords, chordind - pattern_size + 2, \
-				/* get the position of the first chord of the match in @chords */
-				*((unsigned int *)(s - PP_ITEM_SIZE * (pattern_size - 2))), pattern_poly, pattern_size, pattern_notes, result_list);
-			}
-			else
-			{
-				results = c_matchcheck(self, chords, chordind - pattern_size + 2, \
-				*((unsigned int *)(s - PP_ITEM_SIZE * (pattern_size - 2))), pattern_mono, pattern_size, result_list);
+				if (checkfunc == 1) c_polycheck(self, pitchsets, candidates[i], pattern_pitchsets, pattern_size, result_list);
+				else c_matchcheck(self, pitchsets, pp, itemsize, candidates[i], pattern_mono, pattern_size, result_list);
 			}
+			num_candidates = 0;
 		}
 	}
 	return result_list;
@@ -156,56 +160,64 @@ static int rcs(int value, int width, int amount)
 
 
 /*
-   Source preprocessing method. Returns an array consisting of structures with length of six bytes.
-   First 4 bytes store the start position of the chord in source (offset from the start of source).
-   Next 2 bytes are interval data, so that 12 bits represent the possible pitch intervals between notes 
+   Source preprocessing method. Returns an array consisting of structures with length of six bytes (ten for songs 
+   longer than 4 GB; see song.h). First 4 (8) bytes store the start position of the chord in source (offset from 
+   the start of source). Next 2 bytes are interval data, so that 12 bits represent the possible pitch intervals between notes 
    in two chords in when the vocabulary size is 12.
    If the corresponding bit is zero, interval is present. If it is one, interval is not present.
    
    Intervals are octave equivalent, so that for example when 72 - 60 = 12, we take 12 % 12 = 0. 
    Now also negative intervals wrap to positive; for example (60 - 70) % 12 = -10 % 12 = 2.
+
+   Also creates @pitchsets, a pitch set of each chord for the checking functions.
 */
 VALUE c_monopoly_preprocess(VALUE self)
 {
-	char *chords, *s, *so;
+	volatile VALUE chords_str;
+	VALUE preprocessed;
+	char *chords, *s;
 
 	/* because VOCSIZE <= 16, unsigned short is enough */
 	short int b, amount;
 	unsigned short int tmp, ones, tpow, shifts, base;
 	unsigned short int i, chordlen, nextchordlen, *usptr;
 
-	/* note: unsigned short is not enough for spos */
-	unsigned int spos, slen, nextchordspos, chordind, chords_size, *uiptr;
+	/* note: unsigned int is not enough for spos in songs longer than 4 GB */
+	size_t spos, slen, nextchordspos, itemsize, offsetsize;
+	unsigned int chordind, chords_size;
+	uint32_t spos32;
+	uint64_t spos64;
+	pitchset *pitchsets;
+	VALUE pitchsets_str;
 
 	/* get a pointer to chord data */
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = song_chords(self);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 
-	/* s is the result of preprocessing. format: (spos:4, intervals:2). last uint is for storing the spos of the last chord. */
-	slen = chords_size * (sizeof(unsigned int) + sizeof(unsigned short int)) + sizeof(unsigned int);
-	so = s = (char *) ALLOCA_N(char, slen);
+	/* s is the result of preprocessing. format: (spos:4, intervals:2), with 8-byte spos if offsets do not fit to 4 bytes. 
+	   last offset is for storing the spos of the last chord. the result is written directly to the string. */
+	itemsize = (size_t) RSTRING_LEN(chords_str) > UINT32_MAX ? PP_WIDE_ITEM_SIZE : PP_ITEM_SIZE;
+	offsetsize = itemsize - sizeof(unsigned short int);
+	slen = chords_size * itemsize + offsetsize;
+	preprocessed = rb_str_new(NULL, slen);
+	s = RSTRING_PTR(preprocessed);
+	memset(s, 0, slen);	/* the item of the last chord is not computed; keep it zeroed so that saved songs are reproducible */
 
 	ones = pow(2, VOCSIZE) - 1;
 
 	/* scan all chords */
 	for (spos = 0, chordind = 0; chordind < chords_size - 1; chordind++)
 	{
-		chordlen = chords[spos];
+		chordlen = CHORDLEN(chords + spos);
 		nextchordspos = spos + CHORDHEADERLEN + chordlen * NOTELEN;
-		nextchordlen = chords[nextchordspos];
-
-		/* check that source position fits to unsigned int */
-		if (spos > UINT_MAX)
-		{
-			printf("Error: too long source in a song: spos=%u\n", spos);
-			return Qnil;
-		}
+		nextchordlen = CHORDLEN(chords + nextchordspos);
 
-		/* initialize fields: first 4 bytes are the start of the chord in source */ 
+		/* initialize fields: first 4 (8) bytes are the start of the chord in source */ 
 		/* next 2 bytes are interval data */
-		uiptr = (unsigned int *) (s);
-		*uiptr = spos;
-		usptr = (unsigned short int *) (s + sizeof(unsigned int));
+		if (offsetsize == sizeof(spos32)) { spos32 = (uint32_t) spos; memcpy(s, &spos32, sizeof(spos32)); }
+		else { spos64 = spos; memcpy(s, &spos64, sizeof(spos64)); }
+		usptr = (unsigned short int *) (s + offsetsize);
 		*usptr = ones;
 		
 		/* skip chordlen and strt in both chords */
@@ -241,14 +253,29 @@ VALUE c_monopoly_preprocess(VALUE self)
 
 		/* move to the next chord */
 		spos += (NOTELEN * chordlen);
-		s += PP_ITEM_SIZE;
+		s += itemsize;
 	}
 	/* write spos of the last chord to the end of string */
-	uiptr = (unsigned int *) (s);
-	*uiptr = spos;
+	if (offsetsize == sizeof(spos32)) { spos32 = (uint32_t) spos; memcpy(s, &spos32, sizeof(spos32)); }
+	else { spos64 = spos; memcpy(s, &spos64, sizeof(spos64)); }
 	
 	/* save results to instance variable */
-	rb_iv_set(self, "@preprocessed", rb_str_new(so, slen));
+	rb_iv_set(self, "@preprocessed", preprocessed);
+
+	/* pitch set of each chord */
+	pitchsets_str = rb_str_new(NULL, chords_size * sizeof(pitchset));
+	pitchsets = (pitchset *) RSTRING_PTR(pitchsets_str);
+	memset(pitchsets, 0, chords_size * sizeof(pitchset));
+	for (spos = 0, chordind = 0; chordind < chords_size; chordind++, spos += CHORDHEADERLEN + chordlen * NOTELEN)
+	{
+		chordlen = CHORDLEN(chords + spos);
+		for (i = 0; i < chordlen; i++)
+		{
+			b = chords[spos + CHORDHEADERLEN + i * NOTELEN] & 127;
+			pitchsets[chordind].w[b / 64] |= 1ULL << (b % 64);
+		}
+	}
+	rb_iv_set(self, "@pitchsets", pitchsets_str);
 	
 	return self;
 }
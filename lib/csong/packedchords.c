@@ -0,0 +1,161 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Conversion between @chords and the packed chord encoding described in packedchords.h.
+*/
+
+
+#include "song.h"
+#include "packedchords.h"
+
+
+static unsigned char *put_varint(unsigned char *p, unsigned int v)
+{
+	while (v >= 0x80) { *p++ = (v & 0x7f) | 0x80; v >>= 7; }
+	*p++ = v;
+	return p;
+}
+
+
+/* Returns chords in the packed encoding. Raises ArgumentError if a pitch does not fit to 7 bits. */
+static VALUE pack(const unsigned char *chords, long len)
+{
+	VALUE packed;
+	unsigned char *p, *start, *tail, track = 0;
+	unsigned int prevstrt = 0, strt, chordlen, i;
+	unsigned short int dur;
+	long spos;
+
+	/* a chord takes at most 2 + 5 + 3 header bytes, and a note 1 + 1 + 3 bytes */
+	start = p = (unsigned char *) ALLOC_N(unsigned char, len * 2 + 16);
+	tail = (unsigned char *) ALLOC_N(unsigned char, 256 * 4);
+	for (spos = 0; spos + CHORDHEADERLEN <= len; spos += CHORDHEADERLEN + chordlen * NOTELEN)
+	{
+		const unsigned char *notes = chords + spos + CHORDHEADERLEN;
+		unsigned char *t = tail;
+
+		chordlen = chords[spos];
+		memcpy(&strt, chords + spos + 1, sizeof(unsigned int));
+		p = put_varint(p, chordlen);
+		p = put_varint(p, strt - prevstrt);
+		prevstrt = strt;
+
+		for (i = 0; i < chordlen; i++, notes += NOTELEN)
+		{
+			if (notes[0] > 127) { xfree(start); xfree(tail); rb_raise(rb_eArgError, "pitch %d cannot be packed", notes[0]); }
+			*p++ = notes[0] | (notes[3] != track ? 0x80 : 0);
+			if (notes[3] != track) *t++ = track = notes[3];
+			memcpy(&dur, notes + 1, sizeof(unsigned short int));
+			t = put_varint(t, dur);
+		}
+		p = put_varint(p, t - tail);
+		memcpy(p, tail, t - tail);
+		p += t - tail;
+	}
+	packed = rb_str_new((char *) start, p - start);
+	xfree(start);
+	xfree(tail);
+	return packed;
+}
+
+
+/*
+   Returns @chords decoded from packed chords of num_chords chords (including the pseudo-infinity chord). 
+   The result is written to buffer, resized to its length, or to a new string if buffer is nil.
+*/
+static VALUE unpack(const char *packed, unsigned int num_chords, VALUE buffer)
+{
+	VALUE chords_str;
+	unsigned char *p;
+	unsigned short int dur;
+	unsigned int chord, chordlen, i, num_notes = 0;
+	packedcursor c;
+
+	/* count the notes to get the length of the result */
+	packed_start(&c, packed);
+	for (chord = 0; chord < num_chords; chord++) num_notes += packed_chord(&c);
+
+	if (NIL_P(buffer)) chords_str = rb_str_new(NULL, (long) num_chords * CHORDHEADERLEN + (long) num_notes * NOTELEN);
+	else chords_str = rb_str_resize(buffer, (long) num_chords * CHORDHEADERLEN + (long) num_notes * NOTELEN);
+	p = (unsigned char *) RSTRING_PTR(chords_str);
+
+	packed_start(&c, packed);
+	for (chord = 0; chord < num_chords; chord++)
+	{
+		chordlen = packed_chord(&c);
+		*p++ = chordlen;
+		memcpy(p, &c.strt, sizeof(unsigned int));
+		p += sizeof(unsigned int);
+		for (i = 0; i < chordlen; i++)
+		{
+			*p++ = packed_note(&c, i, &dur);
+			memcpy(p, &dur, sizeof(unsigned short int));
+			p += sizeof(unsigned short int);
+			*p++ = c.track;
+		}
+	}
+	return chords_str;
+}
+
+
+/*
+   Returns @chords of a song, decoding it from @packed_chords if the song is packed. A decoded string is not stored,
+   so callers must keep the returned value in a volatile variable while they use its contents.
+*/
+VALUE song_chords(VALUE self)
+{
+	VALUE chords_str = rb_iv_get(self, "@chords"), packed = rb_iv_get(self, "@packed_chords");
+
+	if (!NIL_P(chords_str) || NIL_P(packed)) return chords_str;
+
+	/* including the pseudo-infinity chord */
+	return unpack(RSTRING_PTR(packed), NUM2UINT(rb_iv_get(self, "@num_chords")) + 1, Qnil);
+}
+
+
+/*
+   Returns @chords of a song for a scan of a search. A packed song is decoded to @decoded_chords of init_info, 
+   a buffer shared by the songs of the search, so that scans do not allocate a string for each packed song. 
+   The contents are valid until the next song of the search is decoded.
+*/
+VALUE search_chords(VALUE self, VALUE init_info)
+{
+	VALUE chords_str = rb_iv_get(self, "@chords"), packed = rb_iv_get(self, "@packed_chords"), buffer;
+
+	if (!NIL_P(chords_str) || NIL_P(packed)) return chords_str;
+
+	buffer = rb_iv_get(init_info, "@decoded_chords");
+	if (NIL_P(buffer))
+	{
+		buffer = rb_str_new(NULL, 0);
+		rb_iv_set(init_info, "@decoded_chords", buffer);
+	}
+	return unpack(RSTRING_PTR(packed), NUM2UINT(rb_iv_get(self, "@num_chords")) + 1, buffer);
+}
+
+
+/* Replaces @chords with @packed_chords. Returns self. */
+VALUE c_pack_chords(VALUE self)
+{
+	VALUE chords_str = rb_iv_get(self, "@chords");
+
+	if (NIL_P(chords_str)) return self;
+	rb_iv_set(self, "@packed_chords", pack((unsigned char *) RSTRING_PTR(chords_str), RSTRING_LEN(chords_str)));
+	rb_iv_set(self, "@chords", Qnil);
+	return self;
+}
+
+
+/* Replaces @packed_chords with @chords. Returns self. */
+VALUE c_unpack_chords(VALUE self)
+{
+	if (NIL_P(rb_iv_get(self, "@packed_chords"))) return self;
+	rb_iv_set(self, "@chords", song_chords(self));
+	rb_iv_set(self, "@packed_chords", Qnil);
+	return self;
+}
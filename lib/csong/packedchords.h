@@ -0,0 +1,75 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Packed chord encoding (@packed_chords) and its streaming decoder.
+
+   A packed song holds the same chords as @chords, including the pseudo-infinity chord at the end:
+     chord: <number of notes:varint> <onset minus onset of the previous chord:varint> <pitch byte>* <tail length:varint> <tail>
+     pitch byte: <pitch:7 bits | 0x80 if the track of the note differs from the track of the previous note>
+     tail: for each note, <track:1> if the pitch byte has 0x80 set, then <duration:varint>
+   The onset and track of the previous note are 0 at the start of the song. Varints store 7 bits per byte,
+   least significant first, with the high bit set in all but the last byte. Pitches of a chord are contiguous
+   and the tail can be skipped at once, so that scanning algorithms that need only pitches decode little.
+*/
+
+#ifndef PACKEDCHORDS_H
+#define PACKEDCHORDS_H
+
+/* Decoding position in packed chords: the current chord, its pitch bytes and tail, and the current onset time and track. */
+typedef struct {
+	const unsigned char *next, *pitches, *tail;
+	unsigned int strt;
+	unsigned char track;
+} packedcursor;
+
+
+static inline void packed_start(packedcursor *c, const char *packed)
+{
+	c->next = (const unsigned char *) packed;
+	c->strt = 0;
+	c->track = 0;
+}
+
+static inline unsigned int packed_varint(const unsigned char **p)
+{
+	unsigned int v = 0, shift = 0;
+
+	while (**p & 0x80) { v |= (unsigned int) (*(*p)++ & 0x7f) << shift; shift += 7; }
+	return v | (unsigned int) *(*p)++ << shift;
+}
+
+/* Moves to the next chord. Returns the number of notes in the chord and updates the onset time. */
+static inline unsigned int packed_chord(packedcursor *c)
+{
+	const unsigned char *p = c->next;
+	unsigned int chordlen = packed_varint(&p), taillen;
+
+	c->strt += packed_varint(&p);
+	c->pitches = p;
+	p += chordlen;
+	taillen = packed_varint(&p);
+	c->tail = p;
+	c->next = p + taillen;
+	return chordlen;
+}
+
+/* Returns the pitch of note i of the current chord. */
+static inline unsigned char packed_pitch(const packedcursor *c, unsigned int i)
+{
+	return c->pitches[i] & 0x7f;
+}
+
+/* Reads note i of the current chord; notes must be read in order. Returns its pitch, stores its duration and updates the track. */
+static inline unsigned char packed_note(packedcursor *c, unsigned int i, unsigned short int *dur)
+{
+	if (c->pitches[i] & 0x80) c->track = *c->tail++;
+	*dur = (unsigned short int) packed_varint(&c->tail);
+	return c->pitches[i] & 0x7f;
+}
+
+#endif
@@ -0,0 +1,124 @@
+/*
+   C-Brahms Engine for Musical Information Retrieval
+   University of Helsinki, Department of Computer Science
+
+   Version 0.3.4, October 18th, 2026
+
+   Copyright Mika Turkia
+
+   Cache for pattern tables of the bit-parallel string matching algorithms
+   (MonoPoly, ShiftOrAnd, IntervalMatching). Web users repeat the same melodies,
+   so tables built by the init functions are kept in the process and reused.
+*/
+
+
+#include "song.h"
+
+
+/* Least recently used tables are evicted beyond this; a MonoPoly entry takes 16 kB. */
+#define PATTERN_CACHE_MAX_ENTRIES 1024
+
+static const char *pattern_cache_names[PC_NUM_ALGORITHMS] = { "monopoly", "shiftorand", "intervalmatching" };
+static unsigned long pattern_cache_hits[PC_NUM_ALGORITHMS], pattern_cache_misses[PC_NUM_ALGORITHMS];
+/* key => tables, in least recently used order (a hash keeps the order of insertion) */
+static VALUE pattern_cache = Qnil;
+
+
+/*
+   Returns the cache key of a pattern for an algorithm. If intervals is nonzero, the key is
+   transposition-normalised: it consists of the octave-equivalent intervals between consecutive chords
+   of the monophonic pattern. Otherwise it consists of the pitches.
+*/
+VALUE pattern_cache_key(int algorithm, vector *pattern, unsigned int pattern_size, int intervals)
+{
+	VALUE key;
+	char *k;
+	unsigned int i;
+	int ii;
+
+	key = rb_str_new(NULL, pattern_size + 1);
+	k = RSTRING_PTR(key);
+	k[0] = (char) algorithm;
+
+	for (i = 0; i < pattern_size; i++)
+	{
+		if (!intervals) k[i + 1] = pattern[i].ptch;
+		else if (i == 0) k[i + 1] = 0;
+		else
+		{
+			ii = (pattern[i].ptch - pattern[i - 1].ptch) % VOCSIZE;
+			while (ii < 0) ii += VOCSIZE;
+			k[i + 1] = ii;
+		}
+	}
+	return key;
+}
+
+
+/*
+   Looks up tables for key. On a hit, sets @t, @e, @em and @mask of init_info, moves the entry to the end of 
+   the cache as the most recently used one, and returns 1.
+*/
+int pattern_cache_fetch(int algorithm, VALUE key, VALUE init_info)
+{
+	VALUE tables;
+
+	if (pattern_cache == Qnil) tables = Qnil;
+	else tables = rb_hash_lookup(pattern_cache, key);
+
+	if (tables == Qnil)
+	{
+		pattern_cache_misses[algorithm]++;
+		return 0;
+	}
+
+	pattern_cache_hits[algorithm]++;
+	rb_hash_delete(pattern_cache, key);
+	rb_hash_aset(pattern_cache, key, tables);
+	rb_iv_set(init_info, "@t", RARRAY_PTR(tables)[0]);
+	rb_iv_set(init_info, "@e", RARRAY_PTR(tables)[1]);
+	rb_iv_set(init_info, "@em", RARRAY_PTR(tables)[2]);
+	rb_iv_set(init_info, "@mask", RARRAY_PTR(tables)[3]);
+	return 1;
+}
+
+
+/*
+   Stores @t, @e, @em and @mask of init_info for key, evicting the least recently used entry if the cache is full. 
+   Table string is frozen, since it is shared by later requests.
+*/
+void pattern_cache_store(int algorithm, VALUE key, VALUE init_info)
+{
+	VALUE t;
+
+	if (pattern_cache == Qnil)
+	{
+		pattern_cache = rb_hash_new();
+		rb_global_variable(&pattern_cache);
+	}
+	rb_hash_delete(pattern_cache, key);
+	while (RHASH_SIZE(pattern_cache) >= PATTERN_CACHE_MAX_ENTRIES) rb_funcall(pattern_cache, rb_intern("shift"), 0);
+
+	t = rb_obj_freeze(rb_iv_get(init_info, "@t"));
+	rb_hash_aset(pattern_cache, key, rb_obj_freeze(rb_ary_new3(4, t, rb_iv_get(init_info, "@e"), \
+		rb_iv_get(init_info, "@em"), rb_iv_get(init_info, "@mask"))));
+}
+
+
+/*
+   Returns a hash with [hits, misses] of each algorithm, and the number of cached tables with key "entries".
+*/
+VALUE c_pattern_cache_stats(VALUE self)
+{
+	VALUE stats;
+	int i;
+
+	stats = rb_hash_new();
+	for (i = 0; i < PC_NUM_ALGORITHMS; i++)
+	{
+		rb_hash_aset(stats, rb_str_new2(pattern_cache_names[i]), \
+			rb_ary_new3(2, ULONG2NUM(pattern_cache_hits[i]), ULONG2NUM(pattern_cache_misses[i])));
+	}
+	rb_hash_aset(stats, rb_str_new2("entries"), pattern_cache == Qnil ? INT2FIX(0) : SIZET2NUM(RHASH_SIZE(pattern_cache)));
+	return stats;
+}
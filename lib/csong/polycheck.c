@@ -10,69 +10,21 @@
 #include "song.h"
 
 /*
-   Simple unpublished exact polyphonic pattern checking algorithm for MonoPoly. 
-   Assumes that pitches of the pattern and source are sorted in ascending order. 
+   Simple unpublished exact polyphonic pattern checking algorithm for MonoPoly.
    Exact matching; matched notes need not be stored or evaluated.
+   A candidate matches if each pattern chord is a subset of the corresponding source chord,
+   which is checked with the pitch sets of the chords.
 */
-VALUE c_polycheck(VALUE self, char *chords, unsigned int chordind, unsigned int spos, vector *pattern, unsigned int pattern_size, unsigned int pattern_notes, VALUE result_list)
+VALUE c_polycheck(VALUE self, pitchset *pitchsets, unsigned int chordind, pitchset *pattern_pitchsets, unsigned int pattern_size, VALUE result_list)
 {
 	VALUE zero = Qnil;
-	unsigned int pi, ni, chordlen;
+	unsigned int k;
 
-	pi = 0;
-	ni = 0;
-	chordlen = chords[spos];
-
-
-	while (pi < pattern_notes)
+	for (k = 0; k < pattern_size; k++)
 	{
-
-		if (chords[spos + CHORDHEADERLEN + ni * NOTELEN] > pattern[pi].ptch)
-		{
-			/* Source pitch is greater than pattern pitch, i.e. match can't be found. 1 case. */
-			return Qnil;
-		}
-		else if (chords[spos + CHORDHEADERLEN + ni * NOTELEN] < pattern[pi].ptch)
-		{
-			/* Pattern pitch is greater than source pitch: 2 cases. */
-
-			/* Case 2a. We are at the end of source chord and did not find the pattern pitch, i.e. search failed. */
-			if (ni == chordlen - 1) return Qnil;
-
-			/* Case 2b. We are not at the end of source chord. Try to find the pattern pitch later in the source chord. */
-			ni++;
-		}
-		else
-		{
-			/* Pattern pitch and source pitch are equal: 4 cases. */
-
-			/* Last note matched: succeeded. */
-			if (pi == pattern_notes - 1)
-			{ 
-				break;
-			}
-			else if (pattern[pi].strt != pattern[pi + 1].strt)
-			{
-				/* Case 3a. We are at end of pattern chord; all notes in the pattern chord matched. */
-				/* Move to the next note in the pattern and the next chord in the source. */
-				pi++;
-				ni = 0;
-				spos += CHORDHEADERLEN + chordlen * NOTELEN;
-				chordlen = chords[spos];
-			}
-			else
-			{
-				/* Case 3c. We are at the end of source chord but not at the end of pattern chord: search failed. */
-				if (ni == chordlen - 1) return Qnil;
-
-				/* Case 3d. We are not at end of any chord: move on in both */
-				ni++;
-				pi++;
-			}
-		}
+		if ((pattern_pitchsets[k].w[0] & ~pitchsets[chordind + k].w[0]) | (pattern_pitchsets[k].w[1] & ~pitchsets[chordind + k].w[1])) return Qnil;
 	}
 
-
 	/* If we got here, all pattern notes were found, i.e. match was found. */
 
 	zero = INT2FIX(0);
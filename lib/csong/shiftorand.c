@@ -14,6 +14,7 @@
 
 
 #include "song.h"
+#include "packedchords.h"
 
 
 /*
@@ -23,28 +24,34 @@
    Each bit corresponds to pattern position. If a bit is zero, there is a note with this pitch
    in the pattern in a position indicated by the number of the bit in the word. Otherwise the value of the bit is one.
    Consult the article for details.
+
+   The algorithm is not transposition invariant, so tables are cached by the pitches of the pattern.
 */
 VALUE c_shiftorand_init(VALUE self, VALUE init_info)
 {
 	/*unsigned int i, e, em, mask, pattern_size, t[128];*/
 	unsigned int i, e, em, mask, pattern_size, t[256];
 	vector *pattern;
+	VALUE key;
 
 	/* note: there must not be notes with same pitch in same source chord, or values of t will be confused. */
 	/* therefore we must use monophonic version of the pattern. */
 	pattern = (vector *) RSTRING_PTR(rb_iv_get(init_info, "@pattern_monophonic_vector"));
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_size"));
 
+	key = pattern_cache_key(PC_SHIFTORAND, pattern, pattern_size, 0);
+	if (pattern_cache_fetch(PC_SHIFTORAND, key, init_info)) return init_info;
+
 	/* calculate values */
-	mask = e = pow(2, pattern_size) - 1;
-	em = mask - pow(2, pattern_size - 1);
+	mask = e = LOWBITS(pattern_size);
+	em = mask - BIT((int) pattern_size - 1);
 
 	/* initialize array t */
 	/*for (i = 0; i < 128; i++) t[i] = mask;*/
 	for (i = 0; i < 256; i++) t[i] = mask;
 
 	/* calculate values of t */
-	for (i = 0; i < pattern_size; i++) t[(int) pattern[i].ptch] -= (unsigned int) pow(2, i);
+	for (i = 0; i < pattern_size; i++) t[(int) pattern[i].ptch] -= BIT((int) i);
 
 	/* save results to instance variables */
 	/*rb_iv_set(init_info, "@t", rb_str_new((char *) t, 128 * sizeof(unsigned int)));*/
@@ -52,21 +59,24 @@ VALUE c_shiftorand_init(VALUE self, VALUE init_info)
 	rb_iv_set(init_info, "@e", UINT2NUM(e));
 	rb_iv_set(init_info, "@em", UINT2NUM(em));
 	rb_iv_set(init_info, "@mask", UINT2NUM(mask));
+	pattern_cache_store(PC_SHIFTORAND, key, init_info);
 	return init_info;
 }
 
 
 /*
    Scanning phase. Implementation follows closely the pseudocode presented in the article.
+   Packed songs (see packedchords.h) are scanned directly, decoding only the pitches.
 */
 VALUE c_shiftorand_scan(VALUE self, VALUE init_info)
 {
-	VALUE zero, result_list;
+	VALUE zero, result_list, chords_str;
 	char *chords;
 	unsigned int i, pattern_size, tmp, mask, e, em, *t;
 	unsigned int chordlen = 0;
 	unsigned int chord, chords_size;
 	unsigned int spos;
+	packedcursor c;
 
 	zero = INT2FIX(0);
 	e = NUM2UINT(rb_iv_get(init_info, "@e"));
@@ -76,14 +86,35 @@ VALUE c_shiftorand_scan(VALUE self, VALUE init_info)
 	t = (unsigned int *) RSTRING_PTR(rb_iv_get(init_info, "@t"));
 	result_list = rb_iv_get(init_info, "@matches");
 
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = rb_iv_get(self, "@chords");
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 
+	if (NIL_P(chords_str))
+	{
+		packed_start(&c, RSTRING_PTR(rb_iv_get(self, "@packed_chords")));
+		for (chord = 0; chord < chords_size; chord++)
+		{
+			tmp = mask;
+			chordlen = packed_chord(&c);
+			for (i = 0; i < chordlen; i++) tmp &= t[packed_pitch(&c, i)];
+
+			e = ((e << 1) | tmp) & mask;
+
+			if ((e | em) == em)
+			{
+				rb_ary_push(result_list, rb_ary_new3(6, self, INT2FIX(chord - pattern_size + 1), \
+					INT2FIX(chord), Qnil, zero, zero));
+			}
+		}
+		return result_list;
+	}
+	chords = (char *) RSTRING_PTR(chords_str);
+
 	/* scan all chords */
 	for (spos = 0, chord = 0; chord < chords_size; chord++, spos += (NOTELEN * chordlen))
 	{
 		tmp = mask;
-		chordlen = chords[spos];
+		chordlen = CHORDLEN(chords + spos);
 
 		/* skip chordlen and strt */
 		spos += CHORDHEADERLEN;
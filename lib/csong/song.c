@@ -34,12 +34,25 @@ void Init_Song()
 	/* preprocessing functions */
 	rb_define_method(cSong, "preprocess_monopoly", c_monopoly_preprocess, 0);
 
+	/* native MIDI converter; use Song.from_midifile */
+	rb_define_module_function(cSong, "read_midifile", c_read_midifile, 1);
+	rb_define_private_method(cSong, "create_turningpoints", c_create_turningpoints, 1);
+
+	/* packed chord storage (packedchords.h); chords returns @chords also for packed songs */
+	rb_define_method(cSong, "chords", song_chords, 0);
+	rb_define_method(cSong, "pack_chords", c_pack_chords, 0);
+	rb_define_method(cSong, "unpack_chords", c_unpack_chords, 0);
+
 	/* optional initialization functions; called before search if defined. */
 	rb_define_module_function(cSong, "init_monopoly", c_monopoly_init, 1);
 	rb_define_module_function(cSong, "init_shiftorand", c_shiftorand_init, 1);
 	rb_define_module_function(cSong, "init_intervalmatching", c_intervalmatching_init, 1);
 	rb_define_module_function(cSong, "init_geometric_p2", c_geometric_p2_init, 1);
 	rb_define_module_function(cSong, "init_geometric_p3", c_geometric_p3_init, 1);
+	rb_define_module_function(cSong, "init_dynprog_bp", c_dynprog_bp_init, 1);
+
+	/* hit and miss counters of the pattern table cache used by the initialization functions */
+	rb_define_module_function(cSong, "pattern_cache_stats", c_pattern_cache_stats, 0);
 
 	/* scanning functions */
 	rb_define_method(cSong, "scan_monopoly", c_monopoly_scan, 1);
@@ -51,6 +64,7 @@ void Init_Song()
 	rb_define_method(cSong, "scan_lcts", c_lcts_scan, 1);
 	rb_define_method(cSong, "scan_splitting", c_splitting_scan, 1);
 	rb_define_method(cSong, "scan_dynprog", c_dynprog_scan, 1);
+	rb_define_method(cSong, "scan_dynprog_bp", c_dynprog_bp_scan, 1);
 
 	/* function to get chord data for playing a match */
 	/* arguments: numbers of the first and the last chord */
@@ -64,3 +78,16 @@ void Init_Song()
 	/* optional post-scan phase functions; called after search if defined. */
 	/* rb_define_module_function(cSong, "post_<name>", c_<name>_post, 1); */
 }
+
+
+/*
+   Returns @track_aliases of a song (see TRACK_ALIAS), or NULL if the song has none. 
+   The string is kept in the song, which the caller keeps alive during a scan.
+*/
+unsigned int *song_track_aliases(VALUE self, unsigned int num_tracks)
+{
+	VALUE aliases = rb_iv_get(self, "@track_aliases");
+
+	if (NIL_P(aliases) || (size_t) RSTRING_LEN(aliases) != (num_tracks + 1) * sizeof(unsigned int)) return NULL;
+	return (unsigned int *) RSTRING_PTR(aliases);
+}
@@ -8,16 +8,95 @@
 
 #include <ruby.h>
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
 
 #define VOCSIZE 12
 #define NOTELEN 4
 #define CHORDHEADERLEN 5
-#define PP_ITEM_SIZE (sizeof(unsigned int) + sizeof(unsigned short int))
 #define PNOTERESOLUTION 960
 #define MAX_PATTERN_NOTES 40
 #define GAP_UNSIGNED 255
 #define GAP_SIGNED -127
 
+/* Number of notes of the chord whose header starts at p. Notes with the same pitch are merged, so a chord has at most 
+   128 notes; the length is an unsigned byte, which must not be read as a (signed) char. */
+#define CHORDLEN(p) (*(const unsigned char *) (p))
+
+/* @preprocessed of MonoPoly has an item for each chord: the offset of the chord in @chords, followed by 2 bytes of 
+   interval data. After the items there is the offset of the last chord. Offsets take 4 bytes (PP_ITEM_SIZE items), 
+   or 8 bytes (PP_WIDE_ITEM_SIZE items) if @chords is longer than 4 GB, so that ordinary songs keep the compact layout.
+   Use pp_item_size to get the item size of a song, and pp_spos and pp_intervals to read items. */
+#define PP_ITEM_SIZE (sizeof(uint32_t) + sizeof(unsigned short int))
+#define PP_WIDE_ITEM_SIZE (sizeof(uint64_t) + sizeof(unsigned short int))
+
+static inline size_t pp_item_size(VALUE preprocessed, unsigned int num_chords)
+{
+	return (size_t) RSTRING_LEN(preprocessed) == num_chords * PP_ITEM_SIZE + sizeof(uint32_t) ? PP_ITEM_SIZE : PP_WIDE_ITEM_SIZE;
+}
+
+static inline size_t pp_spos(const char *pp, size_t itemsize, size_t chordind)
+{
+	uint32_t spos;
+	uint64_t wide;
+
+	if (itemsize == PP_ITEM_SIZE) { memcpy(&spos, pp + chordind * PP_ITEM_SIZE, sizeof(spos)); return spos; }
+	memcpy(&wide, pp + chordind * PP_WIDE_ITEM_SIZE, sizeof(wide));
+	return (size_t) wide;
+}
+
+static inline unsigned short int pp_intervals(const char *pp, size_t itemsize, size_t chordind)
+{
+	unsigned short int intervals;
+
+	memcpy(&intervals, pp + (chordind + 1) * itemsize - sizeof(intervals), sizeof(intervals));
+	return intervals;
+}
+
+/* Tracks are stored in @tracks as a track-major matrix: one row of (num_chords + 1) bytes per track. 
+   Row of track k (1..num_tracks) starts at TRACK_ROW; position 0 of each row is unused. */
+#define TRACK_ROW(tracks, k, num_chords) ((tracks) + (size_t) ((k) - 1) * ((num_chords) + 1))
+
+/* Gap-free tracks are stored in @compacted_tracks, with chord positions (1..num_chords) of the notes in @compacted_mappings
+   and num_tracks + 1 offsets in @compacted_offsets. Track k (1..num_tracks) starts at offsets[k - 1]; position 0 is unused,
+   so the track has COMPACTED_LEN notes at positions 1...COMPACTED_LEN. */
+#define COMPACTED_LEN(offsets, k) ((offsets)[k] - (offsets)[(k) - 1] - 1)
+
+/* Track k of a song is a copy of track TRACK_ALIAS(aliases, k) if that is not k. aliases is @track_aliases, 
+   or NULL for songs converted without it (see song_track_aliases). */
+#define TRACK_ALIAS(aliases, k) ((aliases) ? (aliases)[k] : (k))
+
+/* Integer bit masks: bit i, and the lowest n bits set. BIT is 0 for negative i; i must be signed, so cast unsigned 
+   indexes to int. */
+#define BIT(i) ((i) < 0 ? 0U : 1U << (i))
+#define LOWBITS(n) ((n) >= 32 ? ~0U : (1U << (n)) - 1)
+
+/* Deadline of a search: @deadline of init_info in seconds of the monotonic clock (Process::CLOCK_MONOTONIC of Ruby), 
+   or 0 if the search has none. Scan functions that may take long for one song check it with deadline_passed, and 
+   when it has passed, drop the matches of the song and report it with search_timed_out. */
+static inline double search_deadline(VALUE init_info)
+{
+	VALUE deadline = rb_iv_get(init_info, "@deadline");
+
+	return NIL_P(deadline) ? 0 : NUM2DBL(deadline);
+}
+
+static inline int deadline_passed(double deadline)
+{
+	struct timespec ts;
+
+	if (deadline <= 0) return 0;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9 > deadline;
+}
+
+static inline void search_timed_out(VALUE init_info, VALUE result_list, long firstrow)
+{
+	rb_ary_resize(result_list, firstrow);
+	rb_iv_set(init_info, "@timed_out", Qtrue);
+}
+
 #define max2(a,b) ((a)>(b)?(a):(b))
 #define min2(a,b) ((a)<(b)?(a):(b))
 
@@ -30,6 +109,21 @@ typedef struct {
 } vector;
 
 
+/* Pitch presence bitset of a chord: bit p (word p / 64, bit p % 64) is one if the chord contains pitch p.
+   Songs store one for each chord in @pitchsets, patterns one for each pattern chord in @pattern_pitchsets. */
+typedef struct {
+	uint64_t w[2];
+} pitchset;
+
+
+/* Algorithms whose pattern tables are cached by patterncache.c. */
+enum { PC_MONOPOLY, PC_SHIFTORAND, PC_INTERVALMATCHING, PC_NUM_ALGORITHMS };
+
+VALUE pattern_cache_key(int algorithm, vector *pattern, unsigned int pattern_size, int intervals);
+int pattern_cache_fetch(int algorithm, VALUE key, VALUE init_info);
+void pattern_cache_store(int algorithm, VALUE key, VALUE init_info);
+VALUE c_pattern_cache_stats(VALUE self);
+
 VALUE c_shiftorand_init(VALUE self, VALUE init_info);
 VALUE c_shiftorand_scan(VALUE self, VALUE init_info);
 
@@ -59,3 +153,14 @@ VALUE c_lcts_scan(VALUE self, VALUE init_info);
 VALUE c_lcts_distances(VALUE self, VALUE song2);
 
 VALUE c_dynprog_scan(VALUE self, VALUE init_info);
+VALUE c_dynprog_bp_init(VALUE self, VALUE init_info);
+VALUE c_dynprog_bp_scan(VALUE self, VALUE init_info);
+
+VALUE c_read_midifile(VALUE self, VALUE path);
+VALUE c_create_turningpoints(VALUE self, VALUE notes);
+
+VALUE song_chords(VALUE self);
+VALUE search_chords(VALUE self, VALUE init_info);
+unsigned int *song_track_aliases(VALUE self, unsigned int num_tracks);
+VALUE c_pack_chords(VALUE self);
+VALUE c_unpack_chords(VALUE self);
@@ -243,20 +243,44 @@ free(gap_counter);
    return process_results; 
 }
 
-static void preProcessAllTranspositions(unsigned char *P,unsigned char **T, int m, int n, int K, matchList *Mt, tripleNode ***lastrow) {
+/*
+   Produces all the match sets M_{t} in row-by-row order with one counting sort.
+   pitchcount[c] is the number of occurrences of pitch c in T; it gives the size of
+   each M_{t} before any node is created, so that all nodes can be placed into one
+   block (returned to caller) and each M_{t} is a contiguous run of that block.
+*/
+static tripleNode *preProcessAllTranspositions(unsigned char *P,unsigned char **T, int m, int n, int K, matchList *Mt, tripleNode ***lastrow, int *pitchcount, int tmin, int tmax) {
+
+   tripleNode *nodes, *temp;
+   int start[MAX_TRANSPOSITION];
+   int i,j,k,t,c,total;
 
-	 tripleNode *temp;
    /**************************************************************
     * this produces all the match sets M_{t} in row-by-row order *
     **************************************************************/
 
-   int i,j,k,t;
+   // sizes of the match sets; cells outside [tmin,tmax] do not exist
+   for (t=tmin;t<=tmax;t++) start[t] = 0;
+   for (i=1;i<=m;i++)
+      for (c=0;c<GAP_UNSIGNED;c++)
+         if (pitchcount[c]) start[c-(int)P[i]+MAX_TRANSPOSITION/2] += pitchcount[c];
+
+   // prefix sums give the first slot of each M_{t}
+   for (total=0,t=tmin;t<=tmax;t++) {
+      c = start[t];
+      start[t] = total;
+      total += c;
+   }
+   if (total == 0) return NULL;
+   nodes = (tripleNode*) calloc(total, sizeof(tripleNode));
+
+   // scanning cells in (i,j,k) order keeps each M_{t} in row-by-row order
    for (i=1;i<=m;i++)   
       for (j=1;j<=n;j++)
          for (k=1;k<=K;k++) {
 	        if (T[k][j] == GAP_UNSIGNED) continue;  
-            temp = newtripleNode();
-            temp->next = NULL;
+            t = (int)T[k][j]-(int)P[i]+MAX_TRANSPOSITION/2;           
+            temp = &nodes[start[t]++];
             temp->i = i;
             temp->j = j;
             temp->k = k; 
@@ -265,20 +289,20 @@ static void preProcessAllTranspositions(unsigned char *P,unsigned char **T, int
 	    else temp->kappa = INT_MAX;
             // store last row to array (for reporting) 
             lastrow[temp->k][temp->j] = temp; 
-            t = (int)T[k][j]-(int)P[i]+MAX_TRANSPOSITION/2;           
-            if (Mt[t].last != NULL) {
-               Mt[t].last->next = temp;
-               Mt[t].last = temp;
-            }
-            else {
-               Mt[t].first = temp;
-               Mt[t].last = temp;
-            }
          }
-   return;
+
+   // start[t] now points past M_{t}; link the runs into lists
+   for (c=0,t=tmin;t<=tmax;t++) {
+      if (c == start[t]) continue;
+      Mt[t].first = &nodes[c];
+      Mt[t].last = &nodes[start[t]-1];
+      for (;c<start[t]-1;c++) nodes[c].next = &nodes[c+1];
+      nodes[c++].next = NULL;
+   }
+   return nodes;
 }
 
-splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int n, int K, int alpha, int songonce)
+splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int n, int K, int alpha, int songonce, double deadline)
 {
    tripleNode *temp, *temp2;
    tripleNode ***lastrow = (tripleNode***) calloc(K+1, sizeof(tripleNode**));
@@ -290,7 +314,8 @@ splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int
    int kappa;
    splittingResultStruct *process_results = NULL;
    int **gap_counter = (int**)calloc(K+1,sizeof(int*));
-   int i,j,k,t;
+   int pitchcount[GAP_UNSIGNED];
+   int i,j,k,t,tmin,tmax,tpmin,tpmax;
 
    /***********************************************************************
     * this produces the match set M in row-by-row order,                  *
@@ -308,23 +333,39 @@ splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int
    process_results->Mt = Mt;
    process_results->matchlist = NULL;
 
-   // construct match sets for all transpositions
-   preProcessAllTranspositions(P,T,m,n,K,Mt,lastrow);
-
    for (j=0;j<=n;j++)
       for (k=1;k<=K;k++) 
          gap_counter[k][j] = 0;
 	     
+   // gap counters and pitch occurrence counts in one pass over the tracks
+   memset(pitchcount, 0, sizeof(pitchcount));
    for (j=1;j<=n;j++)
       for (k=1;k<=K;k++) 
 	 if (T[k][j] == GAP_UNSIGNED) gap_counter[k][j] = gap_counter[k][j - 1] + 1;
-	 else gap_counter[k][j] = 0;   
+	 else { gap_counter[k][j] = 0; pitchcount[T[k][j]]++; }
+
+   // feasible transpositions lie between the pitch ranges of the tracks and the pattern
+   for (tpmin=0;tpmin<GAP_UNSIGNED && !pitchcount[tpmin];tpmin++);
+   for (tpmax=GAP_UNSIGNED-1;tpmax>=0 && !pitchcount[tpmax];tpmax--);
+   tmin = MAX_TRANSPOSITION; tmax = -1;
+   for (i=1;i<=m && tpmin<=tpmax;i++) {
+      tmin = max2(0, min2(tmin, tpmin-(int)P[i]+MAX_TRANSPOSITION/2));
+      tmax = min2(MAX_TRANSPOSITION-1, max2(tmax, tpmax-(int)P[i]+MAX_TRANSPOSITION/2));
+   }
+
+   // construct match sets for the feasible transpositions
+   process_results->nodes = preProcessAllTranspositions(P,T,m,n,K,Mt,lastrow,pitchcount,tmin,tmax);
    
    // smallest splitting found
    kappa = m+1;    
 
-   // compute in each transposition t
-   for (t=0;t<MAX_TRANSPOSITION; t++) {
+   // compute in each feasible transposition t, until the deadline of the search (see deadline_passed)
+   for (t=tmin;t<=tmax; t++) {
+      if (deadline_passed(deadline)) {
+         process_results->timed_out = 1;
+         break;
+      }
+
       // the following constructs the match set for each row separately
       for (i=1; i<=m; i++) {
          row[i].first = NULL;
@@ -443,23 +484,13 @@ void c_splitting_free(splittingResultStruct *process_results, int m)
 	free(process_results);
 }
 
-void c_splitting_free_ti(splittingResultStruct *process_results, int max_transposition, int K)
+void c_splitting_free_ti(splittingResultStruct *process_results, int K)
 {
-	int t,k;
-	tripleNode *temp, *temp2;
-	
-	/* These should be emptied only after the optimal path is extracted */
-	for (t = 0; t < max_transposition; t++)
-	{
-		temp = process_results->Mt[t].first;
-		while (temp != NULL)
-		{
-			temp2 = temp;
-			temp = temp->next;
-			free(temp2);
-		}
-	}
+	int k;
 	
+	/* These should be emptied only after the optimal path is extracted. */
+	/* All match sets share one block allocated in preProcessAllTranspositions. */
+	free(process_results->nodes);
 	free(process_results->Mt);
 	
 	for (k=1;k<=K; k++) free(process_results->row_ti[k]);
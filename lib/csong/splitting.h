@@ -72,6 +72,8 @@ typedef struct {
 	matchList *row;
 	tripleNode ***row_ti;
 	matchList *Mt;
+	tripleNode *nodes;
+	int timed_out;		/* process_ti stopped at the deadline; the results are incomplete */
 } splittingResultStruct;
  
 
@@ -90,7 +92,7 @@ TCartesianNode *Add(TCartesianNode *node, int v, keyType k);
 TCartesianNode *Delete(TCartesianNode *node);
 TCartesianTree *newCartesianTree();
 splittingResultStruct *process(unsigned char *P, unsigned char **T, int m, int n, int K, int gap, int songonce);
-splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int n, int K, int alpha, int songonce);
-void c_splitting_free_ti(splittingResultStruct *process_results, int max_transposition, int K);
+splittingResultStruct *process_ti(unsigned char *P,unsigned char **T, int m, int n, int K, int alpha, int songonce, double deadline);
+void c_splitting_free_ti(splittingResultStruct *process_results, int K);
 void c_splitting_free(splittingResultStruct *process_results, int m);
 
@@ -18,11 +18,13 @@
 */
 VALUE c_splitting_scan(VALUE self, VALUE init_info)
 {
-	VALUE zero, result_list, matchednotes = Qnil, tracks_ary;
+	volatile VALUE chords_str;
+	VALUE zero, result_list, matchednotes = Qnil, preprocessed_str;
 	char *chords, *preprocessed, *pattern;
-	unsigned char *tracks[17]; /* assumes max 16 tracks */
+	unsigned char *trackmatrix, **tracks;
 	unsigned int i = 0, j,k,pattern_size, errors;
-	unsigned int chordlen = 0, chords_size = 0, spos = 0, num_tracks = 0;
+	unsigned int chordlen = 0, chords_size = 0, num_tracks = 0;
+	size_t spos = 0, itemsize;
 
 	tripleNode *node, *tempnode, *firstnode = NULL;
 	int max_gap, songonce;
@@ -32,7 +34,8 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 
 	/* Test for pattern and chord array sizes */
 	pattern_size = NUM2UINT(rb_iv_get(init_info, "@pattern_notes"));
-	chords = (char *) RSTRING_PTR(rb_iv_get(self, "@chords"));
+	chords_str = search_chords(self, init_info);
+	chords = (char *) RSTRING_PTR(chords_str);
 	chords_size = NUM2UINT(rb_iv_get(self, "@num_chords"));
 	if (pattern_size > chords_size) return Qnil;
 
@@ -43,7 +46,9 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 
 	/* for matched notes, we need to get strt of the first chord, and we get the starting position of the chord */
 	/* from preprocessed data by indexing with firstchord */
-	preprocessed = (char *) RSTRING_PTR(rb_iv_get(self, "@preprocessed"));
+	preprocessed_str = rb_iv_get(self, "@preprocessed");
+	preprocessed = (char *) RSTRING_PTR(preprocessed_str);
+	itemsize = pp_item_size(preprocessed_str, chords_size);
 
 	max_gap = NUM2INT(rb_iv_get(init_info, "@gap"));
 	errors = NUM2INT(rb_iv_get(init_info, "@errors"));
@@ -55,13 +60,25 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 	/* thus neither of these works in all cases. there is no general solution due to MIDI limitations. */
 	num_tracks = NUM2UINT(rb_iv_get(self, "@num_tracks"));
 
-	tracks_ary = rb_iv_get(self, "@tracks");
-	for (i = 1; i <= num_tracks; i++) tracks[i] = (unsigned char *) RSTRING_PTR(RARRAY_PTR(tracks_ary)[i]);
+	/* pointers to the rows of the track matrix; tracks[0] is unused. */
+	trackmatrix = (unsigned char *) RSTRING_PTR(rb_iv_get(self, "@tracks"));
+	tracks = (unsigned char **) malloc((num_tracks + 1) * sizeof(unsigned char *));
+	for (i = 1; i <= num_tracks; i++) tracks[i] = TRACK_ROW(trackmatrix, i, chords_size);
 
 	/* Call search function. now only non-ti; same in both cases. */
-	if (tp_invariance) process_results = process_ti(pattern, tracks, pattern_size, chords_size, num_tracks, max_gap, songonce);
+	if (tp_invariance) process_results = process_ti(pattern, tracks, pattern_size, chords_size, num_tracks, max_gap, songonce, search_deadline(init_info));
 	else process_results = process(pattern, tracks, pattern_size, chords_size, num_tracks, max_gap, songonce);
 
+	/* matches of transpositions not processed before the deadline would be wrong; the song is left unsearched */
+	if (process_results->timed_out)
+	{
+		search_timed_out(init_info, result_list, RARRAY_LEN(result_list));
+		if (tp_invariance) c_splitting_free_ti(process_results, num_tracks);
+		else c_splitting_free(process_results, (int) pattern_size);
+		free(tracks);
+		return result_list;
+	}
+
 	/* if songonce is requested, wrong number of all matches is reported since it is the length of results array. no fix at the moment. */
 	 
 	if (!songonce && tp_invariance)
@@ -86,16 +103,16 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 						/* we can't get references to notes in gaps. */ 
 						/* there would be more point in reporting the notes if durations were reported. */
 						/* get start of the chord by chordindex (tempnode->j - 1) */
-						spos = *((unsigned int *) (preprocessed + (tempnode->j - 1) * PP_ITEM_SIZE));
+						spos = pp_spos(preprocessed, itemsize, tempnode->j - 1);
 
 						/* now we must find note with track number tempnode->k and same pitch. */
-						chordlen = *((char *) (chords + spos));
+						chordlen = CHORDLEN(chords + spos);
 						for (i = 0, spos += CHORDHEADERLEN; i < chordlen; i++, spos += NOTELEN)
 					 	{
-							if (*((char *) (chords + spos + 3)) == (tempnode->k - 1) && \
+							if (*((unsigned char *) (chords + spos + 3)) == (unsigned char) (tempnode->k - 1) && \
 								*((char *) (chords + spos)) == tracks[tempnode->k][tempnode->j])
 							{
-								rb_ary_unshift(matchednotes, UINT2NUM(spos));
+								rb_ary_unshift(matchednotes, SIZET2NUM(spos));
 								break;
 							}
 						}
@@ -131,16 +148,16 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 					/* we can't get references to notes in gaps. */ 
 					/* there would be more point in reporting the notes if durations were reported. */
 					/* get start of the chord by chordindex (tempnode->j - 1) */
-					spos = *((unsigned int *) (preprocessed + (tempnode->j - 1) * PP_ITEM_SIZE));
+					spos = pp_spos(preprocessed, itemsize, tempnode->j - 1);
 
 					/* now we must find note with track number tempnode->k and same pitch. */
-					chordlen = *((char *) (chords + spos));
+					chordlen = CHORDLEN(chords + spos);
 					for (i = 0, spos += CHORDHEADERLEN; i < chordlen; i++, spos += NOTELEN)
 					{
-						if (*((char *) (chords + spos + 3)) == (tempnode->k - 1) && \
+						if (*((unsigned char *) (chords + spos + 3)) == (unsigned char) (tempnode->k - 1) && \
 							*((char *) (chords + spos)) == tracks[tempnode->k][tempnode->j])
 						{
-							rb_ary_unshift(matchednotes, UINT2NUM(spos));
+							rb_ary_unshift(matchednotes, SIZET2NUM(spos));
 							break;
 						}
 					}
@@ -159,8 +176,9 @@ VALUE c_splitting_scan(VALUE self, VALUE init_info)
 	}
 
 	/* free internal data structures of process function that must be freed after extracting the optimal path */
-	if (tp_invariance) c_splitting_free_ti(process_results, MAX_TRANSPOSITION,num_tracks);
+	if (tp_invariance) c_splitting_free_ti(process_results, num_tracks);
 	else c_splitting_free(process_results, (int) pattern_size);
+	free(tracks);
 	return result_list;
 }
 
@@ -27,6 +27,10 @@ class InitInfo
 	# To make algorithm implementations a bit simpler, we create many versions of the pattern.
 	attr_reader :pattern_monophonic_vector, :pattern_polyphonic_vector, :pattern_pitch_string
 
+	# Pitch sets of the pattern chords for checking functions: two 64-bit words for each chord,
+	# bit p is set if the chord contains pitch p. Format is defined in song.h.
+	attr_reader :pattern_pitchsets
+
 	# Holders for parameters used by string matching algorithms.
 	attr_accessor :e, :em, :mask, :t
 
@@ -36,6 +40,20 @@ class InitInfo
 	# Parameters passed by the client.
 	attr_accessor :limit, :sort, :songonce, :checkingfunction, :errors, :gap, :textpattern
 
+	# Deadline of the search in seconds of Process::CLOCK_MONOTONIC, or nil for none. Scans stop when it has passed 
+	# (see expired?); scan functions of long searches also check it while scanning a song, and drop the matches of
+	# a song they do not finish.
+	attr_accessor :deadline
+
+	# True if the search stopped at its deadline, so that the matches are those of the songs searched until then.
+	attr_accessor :timed_out
+
+	# Numbers of songs searched and of songs to search, for the fraction of the collections that a search covered.
+	attr_accessor :songs_searched, :songs_total
+
+	# Number of notes in the songs that have been scanned completely; songs with the same content count once.
+	attr_accessor :notes_searched
+
 	# Converts given pattern to monophonic and polyphonic vectors.
 	# Also converts pattern to a (monophonic) string containing pitches only.
 	# Infinity values are added to end of vector form patterns.
@@ -49,8 +67,15 @@ class InitInfo
 		@pattern_pitch_string = " "
 		@pattern_monophonic_vector = ""
 		@pattern_polyphonic_vector = ""
+		@pattern_pitchsets = "".b
 		@songonce = 0
 		@gap = 0
+		@deadline = nil
+		@timed_out = false
+		@songs_searched = 0
+		@songs_total = 0
+		@notes_searched = 0
+		@decoded_chords = nil	# buffer for chords of packed songs, reused by scans of this search
 
 		pattern.each do |chord|
 
@@ -65,10 +90,13 @@ class InitInfo
 			@pattern_pitch_string.concat(chord.notes[0].ptch)
 			@pattern_monophonic_vector.concat(strt + [chord.notes[0].ptch.ord, chord.notes[0].dur, chord.notes[0].voic].pack("CSC"))
 
+			pitchset = 0
 			chord.notes.each do |note|
 				@pattern_polyphonic_vector.concat(strt + [note.ptch.ord, note.dur, note.voic].pack("CSC"))
+				pitchset |= 1 << (note.ptch.ord & 127)
 				i += 1
 			end
+			@pattern_pitchsets.concat([pitchset & 0xFFFFFFFFFFFFFFFF, pitchset >> 64].pack("QQ"))
 		end
 
 		# Add pseudo infinity value to the end of pattern for geometric algorithms
@@ -76,6 +104,16 @@ class InitInfo
 		@pattern_polyphonic_vector.concat([4294967295].pack("I") + [127, 65535, 127].pack("CSC"))
 		@pattern_notes = i
 	end
+
+	# Returns true if the deadline has passed, and then sets timed_out.
+	def expired?
+		@timed_out ||= (@deadline and Process.clock_gettime(Process::CLOCK_MONOTONIC) > @deadline) ? true : false
+	end
+
+	# Returns the fraction of the songs to search that have been searched.
+	def coverage
+		@songs_total > 0 ? @songs_searched.fdiv(@songs_total) : 1.0
+	end
 end
 
 end
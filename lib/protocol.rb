@@ -0,0 +1,310 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+require 'socket'
+
+require_relative 'note'
+require_relative 'chord'
+
+module MIR
+
+# Error raised for malformed frames and failed requests.
+class ProtocolError < StandardError; end
+
+# Binary request protocol between Client and Server over a TCP or Unix socket.
+#
+# Requests and responses are frames: the 4-byte length of the rest of the frame, a 4-byte request id, a 1-byte code
+# and a value. Integers are big-endian. The code of a request selects the server method (see dispatch) and its value
+# is the array of arguments. A response has the id of its request, code OK or ERROR, and the return value or an error
+# message. A client may send requests without waiting for responses (pipelining). The server handles the requests of
+# a connection concurrently, so responses are matched to requests by id, not by order.
+#
+# A value starts with a tag byte: "n" nil, "t" true, "f" false, "i" 8-byte signed integer, "d" 8-byte double,
+# "s" UTF-8 string or "b" binary string (4-byte length and bytes), "a" array (4-byte count and values).
+# A search pattern is an array of chords; a chord is an array of its start time and the pitch and duration of each note.
+module Protocol
+
+	# Default address of the server: "host:port" for TCP, "unix:path" for a Unix socket.
+	DEFAULT_ADDRESS = "localhost:9822"
+
+	# Request codes.
+	SEARCH = 1
+	GENERATE_MIDI = 2
+	GET_HISTOGRAM = 3
+	GET_SIMILARITIES = 4
+	PAGE = 5
+
+	# Response codes.
+	OK = 0
+	ERROR = 1
+
+	# Longer frames are rejected, so that a corrupt length does not exhaust memory.
+	MAX_FRAME = 256 * 1024 * 1024
+
+	# Values nested deeper (arrays in arrays) are rejected, so that a frame cannot exhaust the stack of decode.
+	MAX_DEPTH = 16
+
+	# Maximum number of requests of a connection handled at once. When it is reached, the server reads no more frames
+	# from the connection until a request completes, so that a pipelining client cannot start any number of threads.
+	MAX_REQUESTS = 16
+
+	# Appends the encoding of a value to a binary string.
+	def Protocol.encode(value, buf = "".b)
+		case value
+		when nil then buf << "n"
+		when true then buf << "t"
+		when false then buf << "f"
+		when Integer then buf << "i" << [value].pack("q>")
+		when Float then buf << "d" << [value].pack("G")
+		when Symbol then encode(value.to_s, buf)
+		when String
+			if value.encoding == Encoding::BINARY then buf << "b" << [value.bytesize].pack("N") << value
+			else
+				s = value.encode(Encoding::UTF_8)
+				buf << "s" << [s.bytesize].pack("N") << s.b
+			end
+		when Array
+			buf << "a" << [value.size].pack("N")
+			value.each do |v| encode(v, buf) end
+		else raise ProtocolError, "cannot encode #{value.class}"
+		end
+		buf
+	end
+
+	# Decodes the value at position pos of a binary string, nested in depth arrays. Returns the value and the position 
+	# after it.
+	def Protocol.decode(data, pos = 0, depth = 0)
+		case data[pos]
+		when "n" then [nil, pos + 1]
+		when "t" then [true, pos + 1]
+		when "f" then [false, pos + 1]
+		when "i" then [fixed(data, pos + 1, 8).unpack1("q>"), pos + 9]
+		when "d" then [fixed(data, pos + 1, 8).unpack1("G"), pos + 9]
+		when "s", "b"
+			len = fixed(data, pos + 1, 4).unpack1("N")
+			s = fixed(data, pos + 5, len)
+			[data[pos] == "s" ? s.force_encoding(Encoding::UTF_8) : s, pos + 5 + len]
+		when "a"
+			raise ProtocolError, "value nested too deep at #{pos}" if depth >= MAX_DEPTH
+			count = fixed(data, pos + 1, 4).unpack1("N")
+			# each value takes at least a byte
+			raise ProtocolError, "truncated value" if count > data.bytesize - pos - 5
+			pos += 5
+			[Array.new(count) { value, pos = decode(data, pos, depth + 1); value }, pos]
+		else raise ProtocolError, "unknown value tag at #{pos}"
+		end
+	end
+
+	# Returns len bytes at pos of data.
+	def Protocol.fixed(data, pos, len)
+		s = data.byteslice(pos, len)
+		raise ProtocolError, "truncated value" if s.nil? or s.bytesize < len
+		s
+	end
+	private_class_method :fixed
+
+	# Writes a frame to a socket.
+	def Protocol.write_frame(io, id, code, value)
+		body = encode(value, [id, code].pack("NC"))
+		io.write([body.bytesize].pack("N"), body)
+	end
+
+	# Reads a frame from a socket. Returns [id, code, value], or nil at the end of the stream.
+	def Protocol.read_frame(io)
+		head = io.read(4)
+		return nil if head.nil?
+		raise ProtocolError, "truncated frame" if head.bytesize < 4
+		len = head.unpack1("N")
+		raise ProtocolError, "bad frame length #{len}" if len < 6 or len > MAX_FRAME
+		body = io.read(len)
+		raise ProtocolError, "truncated frame" if body.nil? or body.bytesize < len
+		id, code = body.unpack("NC")
+		value, pos = decode(body, 5)
+		raise ProtocolError, "trailing bytes in frame" if pos != len
+		[id, code, value]
+	end
+
+	# Converts an array of Chord objects to a pattern value.
+	def Protocol.pattern_value(chords)
+		chords.collect do |chord| [chord.strt] + chord.notes.flat_map { |note| [note.ptch, note.dur] } end
+	end
+
+	# Converts a pattern value to an array of Chord objects.
+	def Protocol.pattern(value)
+		raise ProtocolError, "pattern must be an array of chords" if not value.is_a?(Array)
+		value.collect do |c|
+			raise ProtocolError, "bad chord in pattern" if not c.is_a?(Array) or c.size.even? or not c.all?(Integer)
+			chord = MIR::Chord.new(c[0])
+			c.drop(1).each_slice(2) do |ptch, dur| chord.add(MIR::Note.new(ptch, dur, 0)) end
+			chord
+		end
+	end
+
+	# Calls the server method of a request and returns its value.
+	def Protocol.dispatch(server, code, args)
+		raise ProtocolError, "arguments must be an array" if not args.is_a?(Array)
+		case code
+		when SEARCH
+			raise ProtocolError, "search takes 8 to 11 arguments" if not (8..11).include?(args.size)
+			server.search(args[0], pattern(args[1]), *args.drop(2))
+		when GENERATE_MIDI then server.generate_midi(*args)
+		when GET_HISTOGRAM then server.get_histogram(*args)
+		when GET_SIMILARITIES then server.get_similarities(*args)
+		when PAGE then server.page(*args)
+		else raise ProtocolError, "unknown request #{code}"
+		end
+	end
+
+	# Opens a client socket to an address.
+	def Protocol.connect(address)
+		return UNIXSocket.new(address.delete_prefix("unix:")) if address.start_with?("unix:")
+		host, _, port = address.rpartition(":")
+		socket = TCPSocket.new(host, port.to_i)
+		socket.setsockopt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY, 1)
+		socket
+	end
+
+	# Serves requests at an address by calling methods of server. Each connection has a reading thread, and each
+	# request is handled in a thread of its own, as with DRb, up to MAX_REQUESTS at once. Does not return.
+	def Protocol.serve(address, server)
+		if address.start_with?("unix:")
+			path = address.delete_prefix("unix:")
+			File.delete(path) if File.socket?(path)
+			listener = UNIXServer.new(path)
+		else
+			host, _, port = address.rpartition(":")
+			listener = TCPServer.new(host, port.to_i)
+		end
+		loop do
+			socket = listener.accept
+			socket.setsockopt(Socket::IPPROTO_TCP, Socket::TCP_NODELAY, 1) if socket.is_a?(TCPSocket)
+			Thread.new(socket) do |s| serve_connection(s, server) end
+		end
+	end
+
+	# Reads requests from a connection until it is closed, and writes responses as they are ready.
+	def Protocol.serve_connection(socket, server)
+		lock = Mutex.new
+		workers = []
+		# a slot is taken for each request being handled; push blocks while all are taken
+		slots = SizedQueue.new(MAX_REQUESTS)
+		while (frame = read_frame(socket))
+			slots.push(true)
+			workers.select!(&:alive?)
+			workers.push(Thread.new(*frame) do |id, code, args|
+				begin
+					value = dispatch(server, code, args)
+					status = OK
+				rescue => e
+					value = e.message
+					status = ERROR
+				end
+				begin
+					lock.synchronize do write_frame(socket, id, status, value) end
+				rescue ProtocolError => e
+					lock.synchronize do write_frame(socket, id, ERROR, e.message) end
+				end
+			rescue IOError, SystemCallError
+				# the client has gone
+			ensure
+				slots.pop
+			end)
+		end
+	rescue ProtocolError, IOError, SystemCallError => e
+		puts "error: closing connection: #{e.message}"
+	ensure
+		workers.each(&:join)
+		socket.close
+	end
+
+	# Client side of a connection. The socket is opened on the first request and reopened after it fails, and threads
+	# share it: requests of several threads are pipelined, and a reading thread passes each response to the thread
+	# waiting for it.
+	class Connection
+
+		def initialize(address = DEFAULT_ADDRESS)
+			@address = address
+			@lock = Mutex.new
+			@arrived = ConditionVariable.new
+			@socket = nil
+			@next_id = 0
+			@responses = {}		# id => [code, value], or nil until the response arrives
+			@sockets = {}		# id => socket of a request waiting for its response
+		end
+
+		# Sends a request and returns the value of the response. Raises ProtocolError if the server returns an error.
+		def call(code, *args)
+			response(request(code, args))
+		end
+
+		# Sends a request without waiting for the response. Returns the id of the request for response.
+		def request(code, args)
+			@lock.synchronize do
+				if @socket.nil?
+					begin
+						@socket = Protocol.connect(@address)
+					rescue SystemCallError, SocketError => e
+						raise ProtocolError, "cannot connect to server at #{@address}: #{e.message}"
+					end
+					Thread.new(@socket) do |socket| read_responses(socket) end
+				end
+				id = @next_id = (@next_id + 1) & 0xffffffff
+				@responses[id] = nil
+				@sockets[id] = @socket
+				begin
+					Protocol.write_frame(@socket, id, code, args)
+				rescue IOError, SystemCallError => e
+					@responses.delete(id)
+					@sockets.delete(id)
+					@socket.close rescue nil
+					@socket = nil
+					raise ProtocolError, "cannot send request to server at #{@address}: #{e.message}"
+				end
+				id
+			end
+		end
+
+		# Waits for the response of a request and returns its value.
+		def response(id)
+			code, value = @lock.synchronize do
+				@arrived.wait(@lock) while @responses[id].nil?
+				@responses.delete(id)
+			end
+			raise ProtocolError, value if code != OK
+			value
+		end
+
+		# Closes the socket. Requests waiting for responses fail.
+		def close
+			@lock.synchronize do @socket.close if @socket end
+		end
+
+		private
+
+		def read_responses(socket)
+			while (frame = Protocol.read_frame(socket))
+				id, code, value = frame
+				@lock.synchronize do
+					next if not @sockets.delete(id)
+					@responses[id] = [code, value]
+					@arrived.broadcast
+				end
+			end
+			raise IOError, "connection closed by server"
+		rescue ProtocolError, IOError, SystemCallError => e
+			@lock.synchronize do
+				@socket = nil if @socket.equal?(socket)
+				@sockets.select { |id, s| s.equal?(socket) }.each_key do |id|
+					@sockets.delete(id)
+					@responses[id] = [ERROR, "connection to server at #{@address} lost: #{e.message}"]
+				end
+				@arrived.broadcast
+			end
+			socket.close rescue nil
+		end
+	end
+end
+
+end	# module
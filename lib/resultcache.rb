@@ -0,0 +1,99 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+module MIR
+
+# Cache of match lists of searches, used by Server#search so that repeated queries are served without scanning.
+#
+# The key of a search consists of the algorithm, the pattern and the other search parameters, and the version of the
+# collections, which the server increments when collections are loaded or refreshed. For algorithms whose matches do
+# not depend on the transposition of the pattern, the pitches of the key are relative to the lowest note of the first
+# chord, so that transposed patterns share an entry; the transpositions of cached matches are stored relative to the
+# same note and shifted for each query. Entries are kept in least recently used order, and the oldest ones are
+# evicted when there are more than max_entries entries or more than max_matches matches in all entries.
+class ResultCache
+
+	# Transposition invariant algorithms: 1 if the matches report their transposition, which then depends on the
+	# transposition of the pattern, 0 if they do not.
+	TRANSPOSITION_INVARIANT = { "monopoly" => 1, "intervalmatching" => 1, "geometric_p1" => 1, "geometric_p2" => 1,
+		"dynprog" => 1, "dynprog_bp" => 1, "splitting" => 0 }
+
+	def initialize(max_entries = 1000, max_matches = 200000)
+		@max_entries = max_entries
+		@max_matches = max_matches
+		@entries = {}		# key => frozen match list, least recently used first
+		@matches = 0
+		@hits = 0
+		@misses = 0
+		@evictions = 0
+		@mutex = Mutex.new
+	end
+
+	# Returns the cache key of a search and the pitch that transpositions of its matches are relative to.
+	# The algorithm is that of the query, e.g. polycheck and not monopoly.
+	def key(algorithm, pattern, errors, gap, songonce, textpattern, version)
+		base = (TRANSPOSITION_INVARIANT[algorithm] and pattern[0] and pattern[0].notes[0]) ? pattern[0].notes[0].ptch : 0
+		notes = pattern.collect { |chord| [chord.strt] + chord.notes.flat_map { |note| [note.ptch - base, note.dur] } }
+		[[algorithm, notes, errors, gap, songonce, textpattern, version], base]
+	end
+
+	# Returns a new copy of the matches of a search, or nil if they are not cached.
+	def fetch(algorithm, key, base)
+		matches = @mutex.synchronize do
+			if (matches = @entries.delete(key)) then @entries[key] = matches; @hits += 1
+			else @misses += 1 end
+			matches
+		end
+		return nil if not matches
+		return matches.dup if TRANSPOSITION_INVARIANT[algorithm] != 1
+		matches.collect do |m|
+			m = m.dup
+			m[4] -= base if m[4]
+			m
+		end
+	end
+
+	# Adds the matches of a search. The matches are frozen, as later searches share them.
+	def store(algorithm, key, base, matches)
+		return if matches.size > @max_matches
+		if TRANSPOSITION_INVARIANT[algorithm] == 1
+			matches = matches.collect do |m|
+				m = m.dup
+				m[4] += base if m[4]
+				m.freeze
+			end
+		else matches = matches.collect(&:freeze) end
+		matches.freeze
+		@mutex.synchronize do
+			@matches -= @entries.delete(key).to_a.size
+			@entries[key] = matches
+			@matches += matches.size
+			while @entries.size > @max_entries or @matches > @max_matches
+				@matches -= @entries.shift[1].size
+				@evictions += 1
+			end
+		end
+	end
+
+	# Removes all entries, e.g. when the collections have changed.
+	def clear
+		@mutex.synchronize do
+			@evictions += @entries.size
+			@entries.clear
+			@matches = 0
+		end
+	end
+
+	# Returns the hit and miss counts, number of evictions and size of the cache as a string.
+	def stats
+		@mutex.synchronize do
+			total = @hits + @misses
+			"Result cache hits: #{@hits}/#{total}" + (total > 0 ? " (#{@hits * 100 / total}%)" : "") +
+			"; #{@entries.size} searches (#{@matches} matches) cached, #{@evictions} evicted."
+		end
+	end
+end
+
+end	# module
@@ -0,0 +1,54 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+require 'securerandom'
+
+module MIR
+
+# Sorted match lists of recent searches, from which Server#page renders further pages of results.
+#
+# Each list is identified by a cursor, a random string that is given to the client with the first page. A list is
+# kept until it has not been read for ttl seconds; when there are more than max_sets lists, the least recently
+# read ones are dropped.
+class ResultSets
+
+	def initialize(ttl = 600, max_sets = 1000)
+		@ttl = ttl
+		@max_sets = max_sets
+		@sets = {}		# cursor => [matches, time of last access], least recently used first
+		@mutex = Mutex.new
+	end
+
+	# Stores a match list and returns its cursor.
+	def store(matches)
+		cursor = SecureRandom.hex(8)
+		@mutex.synchronize do
+			expire
+			@sets[cursor] = [matches, Time.now]
+			@sets.shift while @sets.size > @max_sets
+		end
+		cursor
+	end
+
+	# Returns the match list of a cursor, or nil if it has expired.
+	def fetch(cursor)
+		@mutex.synchronize do
+			expire
+			set = @sets.delete(cursor) or return nil
+			@sets[cursor] = [set[0], Time.now]
+			set[0]
+		end
+	end
+
+	private
+
+	# Drops the lists that have not been read for ttl seconds.
+	def expire
+		limit = Time.now - @ttl
+		@sets.shift while not @sets.empty? and @sets.first[1][1] < limit
+	end
+end
+
+end	# module
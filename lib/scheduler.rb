@@ -0,0 +1,125 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+module MIR
+
+# Error raised when a search is rejected because the server has too many searches waiting.
+class OverloadError < StandardError; end
+
+# Runs the scans of Server#search in bounded pools of worker threads, so that expensive searches (e.g. lcts over the
+# whole collection) do not starve cheap ones (e.g. shiftorand).
+#
+# The time of a search is estimated as the rate of its algorithm times the number of notes in the pattern times the
+# number of notes to scan. Rates start from RATES and are calibrated with the measured times of searches. Searches
+# estimated to take at most CHEAP_LIMIT seconds go to the queue of the cheap pool, others to that of the expensive pool.
+# A search is rejected with OverloadError if the estimated time of the searches queued and running in its pool would
+# then exceed the backlog limit of the pool; a search is always admitted to an idle pool.
+#
+# The pools bound how many searches run at once and how many wait, not the CPU time they get: scan functions hold the
+# interpreter lock (GVL) while they scan a song, so workers interleave their scans song by song on one core rather than
+# scan in parallel. A cheap search thus waits at most for the song being scanned by an expensive one, but more workers
+# do not make searches faster.
+class Scheduler
+
+	# Initial rates in seconds per pattern note and scanned note, measured on test collections.
+	RATES = { "shiftorand" => 2e-9, "monopoly" => 1.5e-9, "polycheck" => 1.5e-9, "intervalmatching" => 2.5e-9,
+		"geometric_p1" => 1e-8, "geometric_p2" => 5e-8, "geometric_p3" => 5e-8, "splitting" => 5e-8, "lcts" => 1.5e-7,
+		"dynprog" => 1e-8, "dynprog_bp" => 5e-8 }
+
+	# Rate of algorithms missing from RATES.
+	DEFAULT_RATE = 1e-7
+
+	# Searches estimated to take longer, in seconds, are expensive.
+	CHEAP_LIMIT = 0.25
+
+	# Weight of a measured rate in the calibrated rate of an algorithm.
+	CALIBRATION_WEIGHT = 0.2
+
+	# Pool of worker threads with its queue and the estimated seconds of searches queued and running in it.
+	Pool = Struct.new(:name, :queue, :workers, :backlog, :limit, :waiting, :running)
+
+	# Creates a scheduler with given numbers of workers and backlog limits in estimated seconds for the two pools.
+	def initialize(cheap_workers = 2, expensive_workers = 1, cheap_backlog = 10, expensive_backlog = 60)
+		@rates = RATES.dup
+		@mutex = Mutex.new
+		@pools = [["cheap", cheap_workers, cheap_backlog], ["expensive", expensive_workers, expensive_backlog]].collect do |name, workers, limit|
+			pool = Pool.new(name, Queue.new, nil, 0.0, limit, 0, 0)
+			pool.workers = Array.new(workers) { Thread.new { work(pool) } }
+			pool
+		end
+		@completed = 0
+		@rejected = 0
+	end
+
+	# Returns the estimated time in seconds of a search with an algorithm for a pattern of pattern_notes notes over
+	# notes notes (see SongCollection#search_notes).
+	def estimate(algorithm, pattern_notes, notes)
+		@mutex.synchronize { @rates[algorithm] || DEFAULT_RATE } * pattern_notes * notes
+	end
+
+	# Runs a block in a worker of the pool of a search and returns its value, or raises the exception raised by it.
+	# Raises OverloadError if the pool has too many searches waiting.
+	def run(algorithm, pattern_notes, notes, &block)
+		cost = estimate(algorithm, pattern_notes, notes)
+		pool = @pools[cost <= CHEAP_LIMIT ? 0 : 1]
+		@mutex.synchronize do
+			if pool.backlog > 0 and pool.backlog + cost > pool.limit then
+				@rejected += 1
+				raise OverloadError, "server busy: #{pool.waiting + pool.running} #{pool.name} searches take about " +
+					"#{pool.backlog.round(1)} s; please try again later."
+			end
+			pool.backlog += cost
+			pool.waiting += 1
+		end
+
+		done = Queue.new
+		pool.queue.push(lambda do
+			@mutex.synchronize { pool.waiting -= 1; pool.running += 1 }
+			begin
+				done.push([true, block.call])
+			rescue Exception => e
+				done.push([false, e])
+			ensure
+				@mutex.synchronize do
+					pool.backlog = [pool.backlog - cost, 0.0].max
+					pool.running -= 1
+					@completed += 1
+				end
+			end
+		end)
+		ok, value = done.pop
+		raise value if not ok
+		value
+	end
+
+	# Calibrates the rate of an algorithm with the time in seconds of a search that scanned notes notes (see 
+	# InitInfo#notes_searched).
+	def calibrate(algorithm, pattern_notes, notes, time)
+		return if pattern_notes <= 0 or notes <= 0
+		@mutex.synchronize do
+			rate = @rates[algorithm] || DEFAULT_RATE
+			@rates[algorithm] = rate + CALIBRATION_WEIGHT * (time / (pattern_notes * notes) - rate)
+		end
+	end
+
+	# Returns the numbers of searches waiting and running in the pools, and of completed and rejected searches as a string.
+	def stats
+		@mutex.synchronize do
+			"Scheduler: " + @pools.collect { |pool| "#{pool.running} running, #{pool.waiting} queued #{pool.name} searches" }.join("; ") +
+			" (#{@completed} completed, #{@rejected} rejected)."
+		end
+	end
+
+	private
+
+	# Runs the searches of the queue of a pool.
+	def work(pool)
+		while (job = pool.queue.pop)
+			job.call
+		end
+	end
+end
+
+end	# module
@@ -5,8 +5,8 @@
 #
 # Copyright Mika Turkia
 
-require 'drb'
 require 'daemons'
+require 'cgi'
 
 require_relative 'note'
 require_relative 'chord'
@@ -14,48 +14,148 @@ require_relative 'song'
 require_relative 'cserver/Server'
 require_relative 'songcollection'
 require_relative 'initdata'
+require_relative 'protocol'
+require_relative 'resultcache'
+require_relative 'resultsets'
+require_relative 'scheduler'
 
 module MIR
 
-# This is a server class, whose instance creates a distributed object of itself. 
-# Instances of Client class connect to this distributed object over DRb.
+# This is a server class, whose instance serves requests of Client instances with the binary protocol of Protocol.
 #
-# As a rule, this version returns HTML to the client to avoid DRb traffic (e.g. sending large songs over DRb).
-# Modifications are needed for possible new client applications that do not want HTML.
+# As a rule, this version returns HTML to the client to avoid sending large data (e.g. songs) to it.
+# Client applications that do not want HTML may request pages of search results as JSON or in a binary format
+# (see FORMATS).
 class Server
 
-	# Starts a distributed server i.e. an instance of this class
-	def initialize(dirname)
+	# Starts a server that serves requests at an address (see Protocol::DEFAULT_ADDRESS) until the process is stopped.
+	def initialize(dirname, aux_budget = AuxStore::DEFAULT_BUDGET, address = Protocol::DEFAULT_ADDRESS)
+
+		MIR::AuxStore.budget = aux_budget
 
 		@collections = []
+		@pending = []
+		@load_mutex = Mutex.new
+		@version = 0
+		@result_cache = MIR::ResultCache.new
+		@result_sets = MIR::ResultSets.new
+		@scheduler = MIR::Scheduler.new
 		load_collections(dirname)
+		start_refresher
 
 		# dynamically get algorithm names (public methods whose names begin with "scan_")
 		@algorithms = MIR::Song.public_instance_methods.delete_if {|a| not a =~ /^scan_/ }
 		# should also check that there is a corresponding init function for each scan function
 
-		#Daemons.daemonize({:app_name => "melodysearch_drb_server"})
-		DRb.start_service("druby://localhost:9822", self)
-		DRb.thread.join
+		# queries are accepted while collections are loading; results report the collections not yet searched
+		#Daemons.daemonize({:app_name => "melodysearch_server"})
+		Protocol.serve(address, self)
 	end
 
-	# Loads all .songs files in a given directory
+	# Number of threads loading collections. Marshal.load holds the interpreter lock, so more threads mainly overlap 
+	# reading files with unmarshalling.
+	LOAD_THREADS = 2
+
+	# Starts loading all .songs files and segmented collections (.collection directories) in a given directory in 
+	# background threads. Each collection becomes searchable when it has been loaded. Smaller collections are loaded 
+	# first, so that searches cover them as soon as possible; searches still see the collections in directory order.
 	def load_collections(dirname)
-		re = /.songs$/
-		Dir.foreach(dirname) do |entry|
-			if re.match(entry) then
-				# note: loading from a client results in a crash
-				s = MIR::SongCollection.new
-				s.load(dirname + "/" + entry.sub(re, ''))
-				if s then @collections.push(s); puts "loaded #{s.filepath}"
-				else puts "error: skipping #{dirname + "/" + entry}" end
+		paths = Dir.children(dirname).sort.collect { |entry| dirname + "/" + entry }.select do |path|
+			path =~ /\.songs$/ or (path =~ /\.collection$/ and File.directory?(path))
+		end
+		@collections = Array.new(paths.size)
+		@pending = paths.dup
+
+		queue = Queue.new
+		paths.each_index.sort_by { |i| collection_size(paths[i]) }.each do |i| queue.push(i) end
+		queue.close
+		start = Time.now
+		@loaders = Array.new([LOAD_THREADS, paths.size].min) do
+			Thread.new do
+				while (i = queue.pop)
+					load_collection(paths[i], i)
+					@load_mutex.synchronize do 
+						@pending.delete(paths[i])
+						puts "loaded all collections in #{format('%.2f', Time.now - start)} s" if @pending.empty?
+					end
+				end
+			end
+		end
+	end
+
+	# Returns the collections that have been loaded, in directory order.
+	def collections
+		@collections.compact
+	end
+
+	# Returns a note of the collections that a search of searched collections did not cover because they were still 
+	# loading (pending), or an empty string.
+	def coverage(searched, pending)
+		return "" if pending.empty?
+		"Searched #{searched.size} of #{searched.size + pending.size} collections; still loading: #{pending.join(', ')}."
+	end
+
+	# Interval in seconds between checks for updates of segmented collections.
+	REFRESH_INTERVAL = 10
+
+	# Segments with fewer songs are merged by background compaction.
+	COMPACTION_MIN_SONGS = 1000
+
+	# Starts a thread that compacts segmented collections and loads their changes, so that collections 
+	# updated with admin/update.rb are searchable without restarting the server.
+	def start_refresher
+		@refresher = Thread.new do
+			loop do
+				sleep REFRESH_INTERVAL
+				collections.each do |c|
+					next if not c.segmented?
+					begin
+						merged = MIR::SongCollection.compact_segments(c.filepath, COMPACTION_MIN_SONGS)
+						puts "compacted #{merged} segments of #{c.filepath}" if merged > 0
+						if c.refresh then
+							collections_changed
+							puts "reloaded #{c.filepath} (#{c.songs} songs)"
+						end
+					rescue => e
+						puts "error: refreshing #{c.filepath}: #{e}"
+					end
+				end
 			end
 		end
 	end
 
+	# Loads a .songs file or a segmented collection directory into position i of the collections, and logs the load time.
+	def load_collection(path, i)
+		start = Time.now
+		s = MIR::SongCollection.new
+		if path =~ /\.songs$/ then s.load(path.sub(/\.songs$/, ''))
+		else s.load_segments(path) end
+		# a search sees a collection as loaded, not pending and with the new version at once (see search)
+		collections_changed do @collections[i] = s; @pending.delete(path) end
+		puts "loaded #{s.filepath} (#{s.songs} songs) in #{format('%.2f', Time.now - start)} s"
+	rescue => e
+		puts "error: skipping #{path}: #{e}"
+	end
+
+	# Increments the version of the collections, so that cached search results are no longer used. A given block is 
+	# called in the same critical section, for changes that searches must see together with the version.
+	def collections_changed
+		@load_mutex.synchronize do
+			yield if block_given?
+			@version += 1
+		end
+		@result_cache.clear
+	end
+
+	# Returns the size in bytes of the song data of a .songs file or a segmented collection directory.
+	def collection_size(path)
+		if File.directory?(path) then Dir.glob(path + "/*.songs").sum { |file| File.size(file) }
+		else File.size(path) end
+	end
+
 	# Finds a song by URL of the MIDI file.
 	def find_song(midiurl)
-		@collections.each do |c|
+		collections.each do |c|
 			song = c.find_song(midiurl)
 			return song if song
 		end
@@ -76,7 +176,7 @@ class Server
 
 		# normalized pitch histogram similarities
 		sim = []
-		@collections.each do |c| sim += c.similarities(song, false, false) end
+		collections.each do |c| sim += c.similarities(song, false, false) end
 		sim.sort!
 		sim.reverse!
 
@@ -92,7 +192,7 @@ class Server
 
 		# pitch interval histogram similarities
 		sim = []
-		@collections.each do |c| sim += c.similarities(song, false, true) end
+		collections.each do |c| sim += c.similarities(song, false, true) end
 		sim.sort!
 		sim.reverse!
 		lower = 0; while sim[lower] == 0 do lower += 1 end
@@ -181,8 +281,25 @@ class Server
 		hist << "Metatexts from MIDI file:<br /><br />#{song.metatext.gsub(/\n/, "<br />")}<br /><br />"
 	end
 
-	# Searches from all loaded collections and returns results as a HTML string.
-	def search(algorithm, pattern, limit, songonce, sort, errors, gap, textpattern)
+	# Number of rows in a page of results by default.
+	PAGE_SIZE = 50
+
+	# Result formats of pages and the methods that render them (see cserver.c): a HTML table, a JSON array, or a
+	# compact binary encoding of the matches.
+	FORMATS = { "html" => :matches_to_html, "json" => :matches_to_json, "binary" => :matches_to_binary }
+
+	# Longest time in seconds that a search may take, and the default deadline of searches.
+	SEARCH_TIMEOUT = 60
+
+	# Searches from all loaded collections and returns results as a HTML string, or in another format of FORMATS.
+	# The string contains the first count matches; the matches are kept for rendering further pages with page, and 
+	# results include the cursor for it and the number of matches listed.
+	#
+	# A search stops after timeout seconds (at most SEARCH_TIMEOUT) and returns the matches found until then; results
+	# then include true for a partial search, and the fraction of songs searched.
+	def search(algorithm, pattern, limit, songonce, sort, errors, gap, textpattern, count = PAGE_SIZE, format = "html", timeout = nil)
+		raise ArgumentError, "unknown result format #{format}" if not FORMATS[format]
+		timeout = SEARCH_TIMEOUT if not timeout.is_a?(Numeric) or timeout <= 0 or timeout > SEARCH_TIMEOUT
 		start = Time.new
 		init_info = MIR::InitInfo.new(pattern)
 		init_info.checkingfunction = 0
@@ -191,9 +308,18 @@ class Server
 		init_info.gap = gap
 		init_info.songonce = songonce
 		init_info.textpattern = textpattern
+		init_info.deadline = Process.clock_gettime(Process::CLOCK_MONOTONIC) + timeout
+
+		# the collections to search, those still loading and the version are taken together, so that the note matches
+		# the search and results of a search that missed a collection are not cached for a version that includes it
+		searched, pending, version = @load_mutex.synchronize { [collections, @pending.dup, @version] }
 
 		# get maximum number of notes in a song in all collections */
-		# @collections.each do |c| m = c.notes; if m > init_info.maxnotes then init_info.maxnotes = m end end
+		# collections.each do |c| m = c.notes; if m > init_info.maxnotes then init_info.maxnotes = m end end
+
+		# matches of transposed patterns are cached together for transposition invariant algorithms
+		key, base = @result_cache.key(algorithm, pattern, errors, gap, songonce, textpattern, version)
+		query_algorithm = algorithm
 
 		# this inconvenience should be solved
 		if algorithm == "polycheck" then algorithm = "monopoly"; init_info.checkingfunction = 1 end
@@ -201,23 +327,51 @@ class Server
 		# returns nil if server does not have the requested algorithm
 	 	return nil if not @algorithms.include?("scan_#{algorithm}".to_sym)
 
-		# dynamically calls an init method of the requested algorithm if such a method is defined
-		if MIR::Song.singleton_methods.include?("init_#{ algorithm}".to_sym)
-			MIR::Song.send("init_" + algorithm, init_info) 
-		end
+		if (matches = @result_cache.fetch(query_algorithm, key, base)) then
+			inittime = 0
+			searchtime = Time.new - start
+		else
+			# init and scan run in a worker of the scheduler
+			notes = searched.sum { |c| c.search_notes(textpattern) }
+			inittime, searchtime = @scheduler.run(query_algorithm, init_info.pattern_notes, notes) do
+				start = Time.new
+
+				# dynamically calls an init method of the requested algorithm if such a method is defined
+				if MIR::Song.singleton_methods.include?("init_#{ algorithm}".to_sym)
+					MIR::Song.send("init_" + algorithm, init_info) 
+				end
 
-		inittime = Time.new - start
-		start = Time.new
- 
-		# the actual search phase. matches are added to init_info.matches
-		@collections.each do |c| c.search(algorithm, nil, init_info) end
+				inittime = Time.new - start
+				start = Time.new
+		 
+				# the actual search phase. matches are added to init_info.matches
+				searched.each do |c| c.search(algorithm, nil, init_info) end
 
-		searchtime = Time.new - start
+				searchtime = Time.new - start
 
-		# perform post-scan phase if such a function is defined
-		MIR::Song.send("post_" + algorithm, init_info) if MIR::Song.singleton_methods.include?("post_" + algorithm)
+				# perform post-scan phase if such a function is defined
+				MIR::Song.send("post_" + algorithm, init_info) if MIR::Song.singleton_methods.include?("post_" + algorithm)
+				[inittime, searchtime]
+			end
 
-		matches = init_info.matches
+			# the scheduler is calibrated with the notes actually scanned, which excludes duplicates and songs not reached 
+			# before the deadline; searches restricted by a text pattern are not used, as their times include matching
+			# the metadata of the songs
+			if textpattern.empty? then
+				@scheduler.calibrate(query_algorithm, init_info.pattern_notes, init_info.notes_searched, inittime + searchtime)
+			end
+
+			# matches of a partial search are not cached
+			matches = init_info.matches
+			@result_cache.store(query_algorithm, key, base, matches) if matches and not init_info.timed_out
+		end
+
+		# note of the collections not searched
+		note = coverage(searched, pending)
+		if init_info.timed_out then
+			note = "Search stopped at its deadline of #{timeout} s after #{(init_info.coverage * 100).floor}% of the songs; " +
+				"results are partial. #{note}".rstrip
+		end
 
 		if matches and matches.size > 0 then
 
@@ -297,10 +451,89 @@ class Server
 			# truncate match list to limit
 			if matches.size > limit then matches = matches.slice!(0, limit) end
 
-			# return matches to client
-			[inittime, searchtime, allmatches, counter, matches_to_html(matches)]
+			# return the first page of matches to client
+			cursor = @result_sets.store(matches)
+			[inittime, searchtime, allmatches, counter, render_page(matches, 0, count, format), search_stats, note, cursor, matches.size,
+				init_info.timed_out, init_info.coverage]
 			#[inittime, searchtime, allmatches, counter, "koetulokset"]
-		else [inittime, searchtime, 0, 0, "No results found."] end
+		else
+			empty = format == "html" ? "No results found." : render_page([], 0, count, format)
+			[inittime, searchtime, 0, 0, empty, search_stats, note, nil, 0, init_info.timed_out, init_info.coverage]
+		end
+	end
+
+	# Returns a page of count matches starting from offset of the result list of a search, as a HTML string or in 
+	# another format of FORMATS, and the number of matches in the list. Returns nil if the list has expired.
+	def page(cursor, offset, count, format = "html")
+		raise ArgumentError, "unknown result format #{format}" if not FORMATS[format]
+		matches = @result_sets.fetch(cursor) or return nil
+		[render_page(matches, offset, count, format), matches.size]
+	end
+
+	# Returns count matches starting from offset in a format of FORMATS.
+	def render_page(matches, offset, count, format = "html")
+		offset = offset.clamp(0, matches.size)
+		send(FORMATS[format], matches[offset, count.clamp(1, nil)], offset)
+	end
+
+	# Maximum total size in bytes of the bar numbers of row fragments; those of the least recently listed songs are
+	# dropped beyond it.
+	ROW_FRAGMENTS_BYTES = 64 * 1024 * 1024
+
+	# Row fragments of songs that have been listed in results, least recently used first.
+	@@row_fragments = {}.compare_by_identity
+	@@row_fragments_bytes = 0
+	@@row_fragments_mutex = Mutex.new
+
+	# Returns the parts of the result rows of a song that matches_to_html takes as is: the escaped metadata, link and 
+	# score cells, the start of the cell of the link for playing a match, and the bar numbers of the chords (see 
+	# chord_bars). They are computed when the song is listed and kept while the songs listed since fit to 
+	# ROW_FRAGMENTS_BYTES.
+	def row_fragments(song)
+		@@row_fragments_mutex.synchronize do
+			if (fragments = @@row_fragments.delete(song)) then return @@row_fragments[song] = fragments end
+		end
+
+		text = lambda { |s| s.to_s.empty? ? "n/a" : CGI.escapeHTML(s) }
+		url = song.midiurl.to_s.empty? ? "n/a" : song.midiurl
+		param = CGI.escapeHTML(CGI.escape(url))
+		score = song.scoreurl.to_s.empty? ? "n/a " :
+			"<a href='#{CGI.escapeHTML(song.scoreurl)} '>PS</a> <a href='#{CGI.escapeHTML(song.scoreurl[0...-1])}df'>PDF</a>"
+		cells = "<td>#{text[song.composer]}</td><td>#{text[song.title]}</td><td>#{text[song.opus]}</td>" +
+			"<td>#{text[song.date]}</td><td>#{text[song.style]}</td><td><a href='#{CGI.escapeHTML(url)}'>MIDI</a></td>" +
+			"<td><a href='histogram?filepath=#{param}'>Histogram</a></td><td>#{score}</td>"
+		fragments = [cells.b.freeze, "<td><a href='midi?filepath=#{param}&firstchord=".b.freeze, chord_bars(song).freeze].freeze
+
+		@@row_fragments_mutex.synchronize do
+			if (old = @@row_fragments.delete(song)) then @@row_fragments_bytes -= old[2].bytesize end
+			@@row_fragments[song] = fragments
+			@@row_fragments_bytes += fragments[2].bytesize
+			while @@row_fragments_bytes > ROW_FRAGMENTS_BYTES and @@row_fragments.size > 1
+				@@row_fragments_bytes -= @@row_fragments.shift[1][2].bytesize
+			end
+		end
+		fragments
+	end
+
+	# Returns the statistics of the caches and the scheduler that search results include as a string.
+	def search_stats
+		"#{cache_stats} #{@scheduler.stats}"
+	end
+
+	# Returns hit rates of the pattern table and result caches as a string.
+	def cache_stats
+		"#{pattern_cache_stats} #{@result_cache.stats}"
+	end
+
+	# Returns hit rates of the pattern table cache used by init functions of MonoPoly, ShiftOrAnd and IntervalMatching as a string.
+	def pattern_cache_stats
+		stats = MIR::Song.pattern_cache_stats
+		entries = stats.delete("entries")
+		rates = stats.collect do |algorithm, (hits, misses)|
+			total = hits + misses
+			"#{algorithm} #{hits}/#{total}" + (total > 0 ? " (#{hits * 100 / total}%)" : "")
+		end
+		"Pattern cache hits: #{rates.join(', ')}; #{entries} tables cached."
 	end
 end
 
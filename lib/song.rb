@@ -7,11 +7,13 @@
 
 require 'smf'
 require 'zlib'
+require 'digest'
 
 require_relative 'csong/Song'
 
 require_relative 'midiconvert'
 require_relative 'primes'
+require_relative 'auxstore'
 
 # This module contains classes for Musical Information Retrieval. 
 # This file is part of C-Brahms Engine for Musical Information Retrieval.
@@ -32,7 +34,12 @@ class Song
 	# Notes consist of 1 byte for pitch, 2 bytes for duration, and 1 byte for track (voic). Pitch is char, duration is unsigned short, voic is char.
 	# Note length is defined in song.h; additional note parameters may be added by changing the length.
 	# It should not affect existing algorithms.
-	attr_reader :chords
+	#
+	# To save memory, pack_chords replaces @chords with @packed_chords, a compressed encoding of the same data 
+	# (delta-coded onsets, varint durations and 7-bit pitches with track changes; see csong/packedchords.h), 
+	# and unpack_chords restores it. The chords method (in C) returns @chords decoded also for packed songs.
+	# ShiftOrAnd scans packed chords directly, and MonoPoly does not need them for scanning; other algorithms
+	# decode them for each scan into a buffer of the InitInfo that is reused by all songs of a search.
 
 	# Number of chords in this song. 
 	attr_reader :num_chords
@@ -58,15 +65,73 @@ class Song
 	# An array containing lengths of the tracks. 
 	attr_reader :tracklengths
 
+	# A string containing track data as one track-major matrix with a row of num_chords + 1 bytes for each track.
+	# Row k - 1 holds track k. The first byte of a row is unused, and the following bytes contain the pitch of the highest note 
+	# of the track in each chord, or 255 if the track has no note in that chord. Row layout is defined in song.h.
+	#
+	# This and the other auxiliary data below may be stored separately and loaded when needed; see AuxStore.
+	def tracks
+		AuxStore.load(self, "tracks")
+		@tracks
+	end
+
+	# A string containing the tracks without gap symbols, concatenated in track order. Like a row of @tracks, the part of 
+	# each track starts with an unused byte, followed by the pitches of the notes of the track. 
+	# @compacted_mappings holds a 4-byte chord position (1..num_chords, as in @tracks) for each byte of @compacted_tracks, 
+	# and @compacted_offsets holds num_tracks + 1 4-byte offsets: track k occupies bytes offsets[k - 1]...offsets[k] - 1. 
+	# Computed once at conversion for string matching algorithms (e.g. LCTS) that ignore gaps. Layout is defined in song.h.
+	def compacted_tracks
+		AuxStore.load(self, "tracks")
+		@compacted_tracks
+	end
+
+	def compacted_mappings
+		AuxStore.load(self, "tracks")
+		@compacted_mappings
+	end
+
+	def compacted_offsets
+		AuxStore.load(self, "tracks")
+		@compacted_offsets
+	end
+
 	# A string containing preprocessed byte data for monopoly.
-	# Data format: first 4 bytes containing offset from start of chords data for this chord.
+	# Data format: first 4 bytes containing offset from start of chords data for this chord (8 bytes if chords data 
+	# is longer than 4 GB; see song.h).
 	# Next 2 bytes containing all octave-equivalent intervals in this chord and previous chord.
 	# Intervals are coded to bits so that if interval is present, then the corresponding bit has value 0, else it has value 1. 
-	attr_reader :preprocessed
+	def preprocessed
+		AuxStore.load(self, "monopoly")
+		@preprocessed
+	end
 
 	# An array of primes for SIA(M)E1 algorithm's hash table. Array contains a prime to be used as hash table size for each pattern size. 
 	# Note that SIA(M)E1 is not included in public package due to patent reasons. 
-	attr_reader :primes
+	def primes
+		AuxStore.load(self, "primes")
+		@primes
+	end
+
+	# A string of num_tracks + 1 4-byte track numbers (the first is unused). Item k is the first track whose row in @tracks 
+	# is identical to that of track k, or k itself. Track-based algorithms scan a doubled track only once. 
+	def track_aliases
+		AuxStore.load(self, "tracks")
+		@track_aliases
+	end
+
+	# SHA-256 digest of the data that the algorithms scan: chords, tracks, P3 turning points and MIDI division. 
+	# Songs with equal digests give equal matches, so that a collection scans only one of them (see SongCollection).
+	# Computed at conversion, or when first needed for songs converted by older versions.
+	def content_hash
+		create_content_hashes if not @content_hash
+		@content_hash
+	end
+
+	# Makes this song use the chord data of a song with the same content hash, so that it is stored only once.
+	def share_data(song)
+		@chords = song.instance_variable_get(:@chords)
+		@packed_chords = song.instance_variable_get(:@packed_chords)
+	end
 
 	# MIDI file path.
 	attr_accessor :filepath
@@ -115,10 +180,28 @@ class Song
 		create_tracks_and_chords(result.notes)
 		result = nil
 		preprocess_monopoly
+		create_content_hashes if @num_chords > 0
+	end
+
+	# Converts a MIDI file with the native converter (csong/midi2chords.c). Returns nil if the file has no notes.
+	# The result is identical to SMF::Sequence.decodefile(path).convert, but conversion is much faster.
+	def Song.from_midifile(path)
+		song = read_midifile(path)
+		song.complete_native_conversion if song
+	end
+
+	# Does the parts of conversion that the native converter leaves to Ruby. Returns self.
+	def complete_native_conversion
+		@metatext = Zlib::Deflate.deflate(@metatext)
+		create_primes
+		preprocess_monopoly
+		create_content_hashes
+		self
 	end
 
 	# MetaText events collected from MIDI file.
 	def metatext
+		AuxStore.load(self, "metatext")
 		if @metatext
 			Zlib::Inflate.inflate(@metatext)
 		else ''
@@ -146,27 +229,31 @@ class Song
 		h = []
 		sum = 0
 		255.times do |i| h[i] = 0 end
-		@tracks.each do |t|
-			if t then 
-				i = 2
-				# tracks contain real notes and dummy notes of value 255; idea is to skip dummy notes
-				while i < t.size do 
-
-					# first note must be real
-					while t[i - 1].ord == 255 and i < t.size do i += 1 end
-					break if i >= t.size - 1
-					first = t[i - 1].ord
-
-					# second note must be real
-					while t[i] && t[i].ord == 255 and i < t.size do i += 1 end
-					if i < t.size then sum += 1; h[127 + t[i].ord - first] += 1 end
-					i += 1
-				end 
-			end
+		1.upto(@num_tracks) do |k|
+			t = track(k)
+			i = 2
+			# tracks contain real notes and dummy notes of value 255; idea is to skip dummy notes
+			while i < t.size do 
+
+				# first note must be real
+				while t.getbyte(i - 1) == 255 and i < t.size do i += 1 end
+				break if i >= t.size - 1
+				first = t.getbyte(i - 1)
+
+				# second note must be real
+				while t.getbyte(i) && t.getbyte(i) == 255 and i < t.size do i += 1 end
+				if i < t.size then sum += 1; h[127 + t.getbyte(i) - first] += 1 end
+				i += 1
+			end 
 		end
 		[h, sum]
 	end
 
+	# Returns the row of track k (1..num_tracks) from the track matrix as a string of num_chords + 1 bytes.
+	def track(k)
+		tracks.byteslice((k - 1) * (@num_chords + 1), @num_chords + 1)
+	end
+
 	# Returns a normalized pitch interval histogram array, i.e. histogram returned by tracks_pitch_interval_histogram 
 	# where each value is divided by number of calculated intervals.
 	def tracks_pitch_interval_histogram_normalized
@@ -190,7 +277,7 @@ class Song
 	# Therefore e.g. drum track played with piano may make the actual melody unrecognizable.
 	def generate_midi(firstchord, lastchord)
 		# get note data
-		chordarray = get_matched_chords(firstchord, lastchord)
+		chordarray = AuxStore.with_sections(self, ["monopoly"]) { get_matched_chords(firstchord, lastchord) }
 		if chordarray == nil then error end
 
 		# create a midi file from chord array
@@ -227,19 +314,18 @@ class Song
 		if notes.size == 0 then return nil end
 		# puts notes.inspect
 
-		# sort notes according to start time and pitch
-		notes.sort! do |a, b|
-			if a[0] == b[0] then a[1] <=> b[1]
-			else a[0] <=> b[0] end
-		end
+		# sort notes according to start time and pitch; duration and track break ties so that the order
+		# is fully determined (the native converter uses the same order).
+		notes.sort!
 
 		# create chord string. 
 		# format: ( <chordlen:1><strt:4> (<ptch:1><dur:2><voic:1>)* )*
 		@chords = ""
 
-		# tracks array starts from index 1, and also pitch data on a track starts from index 1
-		@tracks = []
-		@num_tracks.times do |i| @tracks[i + 1] = " " end
+		# tracks array starts from index 1, and also pitch data on a track starts from index 1.
+		# tracks are binary strings so that the gap symbol 255 is stored as a single byte.
+		tracks = []
+		@num_tracks.times do |i| tracks[i + 1] = String.new(" ", encoding: Encoding::BINARY) end
 
 		strt = notes[0][0]
 		tempchord = [ notes[0].push(@num_chords) ]
@@ -253,11 +339,7 @@ class Song
 				# chord boundary was crossed
 				@num_chords += 1
 
-				# add chordlen to num_notes
-				if tempchord.size > 255 then 
-					puts "ERROR: maximum chord size exceeded. exiting."
-					exit
-				end
+				# add chordlen to num_notes; the stored chord has no duplicate pitches, so its length fits to a byte
 				@num_notes_with_duplicates += tempchord.size
 				@maxpoly_with_duplicates = tempchord.size if tempchord.size > @maxpoly_with_duplicates
 
@@ -268,7 +350,7 @@ class Song
 				tempchord.reverse_each do |note|
 					# put pitch of the note to right track
 					if @tracklengths[note[3] + 1] < @num_chords
-						@tracks[note[3] + 1].concat(note[1])
+						tracks[note[3] + 1].concat(note[1])
 						@tracklengths[note[3] + 1] += 1
 					end
 
@@ -280,7 +362,7 @@ class Song
 				end
 
 				# put null symbols to other tracks
-				@num_tracks.times do |j| if @tracklengths[j + 1] < @num_chords then @tracks[j + 1].concat(255); @tracklengths[j + 1] += 1 end end
+				@num_tracks.times do |j| if @tracklengths[j + 1] < @num_chords then tracks[j + 1].concat(255); @tracklengths[j + 1] += 1 end end
 
 				# append chord with no duplicates to chords string
 				@maxpoly = tempchord_noduplicates.size if tempchord_noduplicates.size > @maxpoly
@@ -307,13 +389,16 @@ class Song
 			end
 		end
 
+		# store tracks as one track-major matrix; all rows have the same length num_chords + 1.
+		@tracks = tracks.compact.join.b
+		tracks = nil
+		create_compacted_tracks
+
 		# Add pseudo infinity value to the end of @chords for geometric algorithms
 		@chords.concat([1].pack("C") + [4294967295].pack("I"))	# chordlen and strt
 		@chords.concat([127,65535,127].pack("CSC"))		# pitch, duration, track
 
-		# For SIA(M)E1 hashtable: generate primes for all pattern sizes (note max. pattern size 32).
-		# Uses GPL'd code from K.Kodama; see directory lib/poly-ruby.
-		for i in 2...33 do @primes[i] = Number.nextPrime(i * @num_notes * 2 + 1) end
+		create_primes
 
 		# generate turning points arrays for geometric algorithm P3
 		create_turningpoints(notes)
@@ -322,6 +407,47 @@ class Song
 	end
 
 
+	# For SIA(M)E1 hashtable: generate primes for all pattern sizes (note max. pattern size 32).
+	# Uses GPL'd code from K.Kodama; see directory lib/poly-ruby.
+	def create_primes
+		for i in 2...33 do @primes[i] = Number.nextPrime(i * @num_notes * 2 + 1) end
+	end
+
+	# Computes @content_hash and @track_aliases.
+	def create_content_hashes
+		AuxStore.with_sections(self, ["tracks", "p3"]) do
+			c = chords
+			t = tracks
+			startpoints = @preprocessed_p3_startpoints.to_s
+			endpoints = @preprocessed_p3_endpoints.to_s
+			digest = Digest::SHA256.new
+			digest << [@quarternoteduration, @num_tracks, c.bytesize, t.bytesize, startpoints.bytesize, endpoints.bytesize].pack("I6")
+			digest << c << t << startpoints << endpoints
+			@content_hash = digest.digest
+
+			first = {}
+			aliases = [0]
+			1.upto(@num_tracks) do |k| aliases[k] = (first[Digest::SHA256.digest(track(k))] ||= k) end
+			@track_aliases = aliases.pack("I*")
+		end
+	end
+
+	# Creates gap-free copies of the tracks and their chord position mappings from @tracks.
+	def create_compacted_tracks
+		@compacted_tracks = "".b
+		@compacted_mappings = "".b
+		offsets = [0]
+		1.upto(@num_tracks) do |k|
+			row = track(k).bytes
+			positions = (1..@num_chords).reject { |i| row[i] == 255 }
+			@compacted_tracks << [0].concat(row.values_at(*positions)).pack("C*")
+			@compacted_mappings << [0].concat(positions).pack("I*")
+			offsets << @compacted_tracks.bytesize
+		end
+		@compacted_offsets = offsets.pack("I*")
+	end
+
+
 	# for clarity, create P3 turning points separately by doing another scan over the notes.
 	# overlapping notes are merged. 
 	# always must be so that prevnote.strt <= thisnote.strt. therefore 3 possible cases exist:
@@ -331,83 +457,9 @@ class Song
 	#	    -
 	# 	3. - -
 	# we must generate turning points from the original data, so that overlapping notes are preserved and can be merged together.
-	def create_turningpoints(notes)
-
-		# notes = [[0,0,10,1], [0,0,100,1], [0,0,20,1]]
-
-		# array for tracking if note with this pitch is already on; if so, the overlap is removed.
-		# items: [start point, end point, startchordindex, endchordindex]
-		# (start and end points are MIDI onset times.)
-		notes_on = []
-
-		startpoints = []
-		endpoints = []
-		128.times do |ptch| notes_on[ptch] = nil end
-
-		# process all notes returned from MIDI conversion.
-		notes.each_with_index do |n, i|
-			strt = n[0]
-			ptch = n[1]
-			endp  = n[0] + n[2]
-			chordind = n[4]
-
-			if notes_on[ptch].nil? then
-				# if note with this pitch is not on, add to notes_on array.
-				# endchordindex is the index of the chord where the note ends. initially it is the same as startchordindex, since
-				# we cannot say where the note actually ends. only if there is overlap with a later note we update
-				# end chord index to chord index of the last overlapping note.
-				notes_on[ptch] = [strt, endp, chordind]
-			elsif strt <= notes_on[ptch][1] then 
-				# do this branch if strt of current note is smaller or equivalent to end point of last note;
-				# i.e. if the current note overlaps with the note that is already on.
-				# here we update endchordind.
-				if endp > notes_on[ptch][1] then notes_on[ptch][1] = endp; notes_on[ptch][2] = chordind end
-			else
-				# do this branch if the last note ended before this note started.
-				# save the turning points of the last note and add new note to the notes_on array.
-
-				# both startpoints and endpoints get the end chord index, since what we want is to play the merged note in full 
-				# and so we must play also the latter part which is in a later chord than startchord indicates (endchord).
-				startpoints.push([notes_on[ptch][0], ptch, notes_on[ptch][2]])
-				endpoints.push([notes_on[ptch][1], ptch, notes_on[ptch][2]])
-				notes_on[ptch] = [strt, endp, chordind]
-			end
-		end
-
-		# write notes that are open
-		notes_on.each_with_index do |no,ptch| 
-			if not no.nil? then startpoints.push([no[0], ptch, no[2]]); endpoints.push([no[1], ptch, no[2]]) end 
-		end
-
-		# sort
-		startpoints.sort! do |a, b|
-			if a[0] == b[0] then a[1] <=> b[1]
-			else a[0] <=> b[0] end
-		end
-		endpoints.sort! do |a, b|
-			if a[0] == b[0] then a[1] <=> b[1]
-			else a[0] <=> b[0] end
-		end
-
-		# write C array		
-		@preprocessed_p3_startpoints = ""
-		@preprocessed_p3_endpoints = ""
-		@preprocessed_p3_num_turningpoints = startpoints.size
-		# also startpoints must be sorted because open notes are written at end.
-		startpoints.each do |tp|
-			# all values are unsigned ints
-			@preprocessed_p3_startpoints.concat(tp.pack("III"))
-			# puts "sp: #{tp[0]} #{tp[1]} #{tp[2]}"
-		end
-		endpoints.each do |tp|
-			@preprocessed_p3_endpoints.concat(tp.pack("III"))
-			# puts "ep: #{tp[0]} #{tp[1]} #{tp[2]}"
-		end
-
-		notes_on = nil
-		startpoints = nil
-		endpoints = nil
-	end
+	#
+	# Implemented in C (create_turningpoints in csong/midi2chords_wrapper.c), shared with the native converter.
+	# Sets @preprocessed_p3_startpoints, @preprocessed_p3_endpoints and @preprocessed_p3_num_turningpoints.
 
 end
 
@@ -6,9 +6,11 @@
 # Copyright Mika Turkia
 
 require 'cgi'
+require 'digest'
 require_relative 'song'
 require_relative 'initdata'
 require_relative 'midiconvert'
+require_relative 'textindex'
 
 
 module MIR
@@ -27,6 +29,12 @@ class SongCollection
 		@chords = nil
 		@notes = nil
 		@notes_with_duplicates = nil
+		@segment_dir = nil
+		@segments = {}
+		@segment_indexes = {}
+		@generation = nil
+		@physical = {}.compare_by_identity
+		@text_index = TextIndex.new(@songs)
 	end
 
 	# Returns number of songs in this collection. 
@@ -34,6 +42,11 @@ class SongCollection
 		@songs.size
 	end
 
+	# Returns number of distinct songs in this collection, i.e. songs that are scanned by searches (see index_duplicates).
+	def distinct_songs
+		@songs.size - @physical.size
+	end
+
 	# Returns a song object with index i.
 	def get_song(i)
 		@songs[i]
@@ -101,7 +114,7 @@ class SongCollection
 		@songs.each_with_index do |song, i|
 			@songs.each do |song2|
 				puts "Comparing: #{song.filepath}, #{song2.filepath}"
-				min = song.lcts_distances(song2).min
+				min = AuxStore.with_sections([song, song2], ["tracks"]) { song.lcts_distances(song2).min }
 				puts "Result:    #{min}:\t#{song.filepath}, #{song2.filepath}"
 				table.push([min, song, song2]) if song != song2
 			end
@@ -123,6 +136,15 @@ class SongCollection
 		[@notes, @notes_with_duplicates]
 	end
 
+	# Returns the number of notes in the songs that a search with a text pattern may scan: the songs that are 
+	# candidates for the pattern in the text index, or all songs for an empty pattern. Used for estimating the time
+	# of a search before it runs (see Scheduler).
+	def search_notes(textpattern)
+		return notes[0] if textpattern.empty?
+		songs = @text_index.songs
+		@text_index.candidates(textpattern).sum { |i| songs[i].num_notes }
+	end
+
 	# Returns number of chords in this collection. 
 	def chords 
 		if not @chords then
@@ -161,21 +183,209 @@ class SongCollection
 
 
 	# Loads songs in a given file into this collection. 
+	# If the collection has an .aux file, auxiliary data of the songs is loaded from it when needed (see AuxStore).
 	def load(filename)
 		File.open(filename + ".songs", "r") do |file|
 			@songs = Marshal.load(file)
 		end
 		@filepath = filename + ".songs"
+		AuxStore.new(filename + ".aux", @songs) if File.exist?(filename + ".aux")
+		@physical = index_duplicates(@songs)
+		@text_index = TextIndex.new(@songs)
 	end
 
 	# Saves the songs in this collection into a given file.
-	def save(filename)
+	# With separate_aux, auxiliary data of the songs is saved to a separate .aux file, so that it is loaded only when needed.
+	def save(filename, separate_aux = true)
+		if separate_aux then AuxStore.write(filename + ".aux", @songs)
+		elsif File.exist?(filename + ".aux") then File.delete(filename + ".aux") end
 		File.open(filename + ".songs", "w") do |file|
-			Marshal.dump(@songs, file)
+			Marshal.dump(separate_aux ? @songs.collect { |song| AuxStore.strip(song) } : @songs, file)
+		end
+	end
+
+
+	# Segmented collections
+	#
+	# A segmented collection is a directory (name.collection) of immutable segment files and a manifest. 
+	# A segment file has the format of a .songs file. The manifest is a marshalled hash:
+	#   "generation"   => incremented on each change of the manifest
+	#   "next_segment" => number of the next segment file
+	#   "segments"     => names of the segment files in collection order
+	#   "sizes"        => segment name => number of songs in the segment
+	#   "files"        => MIDI file path => [SHA256 of the file, name of the segment containing its song or nil]
+	#   "tombstones"   => [segment name, MIDI file path] pairs of songs that have been deleted or replaced
+	#
+	# Writers (update_segments, SongCollection.compact_segments) hold an exclusive lock on the directory and write
+	# segments before the manifest, which is replaced atomically. Readers hold a shared lock while loading.
+
+	# Returns true if this collection has been loaded from a segmented collection directory.
+	def segmented?
+		not @segment_dir.nil?
+	end
+
+	# Returns the manifest of a segmented collection directory, or a manifest of an empty collection.
+	def SongCollection.read_manifest(dir)
+		if File.exist?(dir + "/manifest") then File.open(dir + "/manifest", "rb") { |file| Marshal.load(file) }
+		else { "generation" => 0, "next_segment" => 1, "segments" => [], "sizes" => {}, "files" => {}, "tombstones" => [] } end
+	end
+
+	# Replaces the manifest of a segmented collection directory atomically.
+	def SongCollection.write_manifest(dir, manifest)
+		manifest["generation"] += 1
+		File.open(dir + "/manifest.tmp", "wb") do |file| Marshal.dump(manifest, file); file.fsync end
+		File.rename(dir + "/manifest.tmp", dir + "/manifest")
+	end
+
+	# Calls the given block holding a lock (File::LOCK_EX or File::LOCK_SH) on a segmented collection directory.
+	def SongCollection.with_lock(dir, mode)
+		File.open(dir + "/lock", File::RDWR | File::CREAT) do |file|
+			file.flock(mode)
+			yield
+		end
+	end
+
+	# Loads a segmented collection directory into this collection. 
+	def load_segments(dir)
+		@segment_dir = dir
+		@segments = {}
+		@segment_indexes = {}
+		@generation = nil
+		@filepath = dir
+		refresh
+	end
+
+	# Loads changes of the manifest of a segmented collection: new segments are loaded, segments removed by compaction
+	# are dropped, and songs with tombstones are left out. Songs are replaced at once, so that searches running 
+	# concurrently see either the old or the new songs. Returns true if the collection changed.
+	def refresh
+		return false if not @segment_dir
+		SongCollection.with_lock(@segment_dir, File::LOCK_SH) do
+			manifest = SongCollection.read_manifest(@segment_dir)
+			return false if manifest["generation"] == @generation
+
+			# segments and their text indexes are immutable, so those of segments loaded before are reused
+			segments = {}
+			segment_indexes = {}
+			manifest["segments"].each do |name|
+				segments[name] = @segments[name] || File.open(@segment_dir + "/" + name, "rb") { |file| Marshal.load(file) }
+				segment_indexes[name] = @segment_indexes[name] || TextIndex.new(segments[name])
+			end
+			tombstones = {}
+			manifest["tombstones"].each do |t| tombstones[t] = true end
+
+			songs = []
+			manifest["segments"].each do |name|
+				segments[name].each do |song| songs.push(song) if not tombstones[[name, song.filepath]] end
+			end
+
+			@segments = segments
+			@segment_indexes = segment_indexes
+			@physical = index_duplicates(songs)
+			@text_index = CombinedTextIndex.new(manifest["segments"].collect { |name| segment_indexes[name] }, songs)
+			@songs = songs
+			@generation = manifest["generation"]
+			@maxpoly = @maxpoly_with_duplicates = @chords = @notes = @notes_with_duplicates = nil
+		end
+		true
+	end
+
+	# Updates a segmented collection directory from MIDI files under mididir. Files whose content hash has not changed
+	# are skipped. New and changed files are converted into a new segment, and replaced and deleted songs get tombstones. 
+	# A changed file that fails to convert keeps its old song, and is converted again on the next update.
+	# Chord data of the new songs is packed if packed is true. Returns the failures of conversion as (path, message) pairs.
+	def update_segments(dir, mididir, native = true, workers = 1, packed = false)
+		Dir.mkdir(dir) if not File.directory?(dir)
+		SongCollection.with_lock(dir, File::LOCK_EX) do
+			manifest = SongCollection.read_manifest(dir)
+			known = manifest["files"]
+
+			files = midifiles(mididir)
+			hashes = {}
+			files.each do |file| hashes[file] = Digest::SHA256.file(file).hexdigest end
+			changed = files.select { |file| known[file].nil? or known[file][0] != hashes[file] }
+			deleted = known.keys.reject { |file| hashes.key?(file) }
+			puts "#{files.size} files: #{changed.size} new or changed, #{deleted.size} deleted."
+			return [] if changed.empty? and deleted.empty?
+
+			# tombstones for the songs of deleted files
+			deleted.each do |file|
+				manifest["tombstones"].push([known[file][1], file]) if known[file][1]
+				known.delete(file)
+			end
+
+			results = changed.empty? ? [] : convert_files(changed, native, workers)
+			songs = results.select { |r| r.is_a?(Song) }
+			songs.each do |song| song.pack_chords end if packed
+			segment = nil
+			if songs.size > 0
+				segment = format("segment-%06d.songs", manifest["next_segment"])
+				manifest["next_segment"] += 1
+				File.open(dir + "/" + segment, "wb") do |file| Marshal.dump(songs, file); file.fsync end
+				manifest["segments"].push(segment)
+				manifest["sizes"][segment] = songs.size
+			end
+
+			# old versions of converted files get tombstones; failed files keep their old entries (or none for new files),
+			# whose hashes differ from those of the files, so that they are converted again on the next update
+			failures = []
+			changed.each_with_index do |file, i|
+				if results[i].is_a?(String) then failures.push([file, results[i]]); next end
+				manifest["tombstones"].push([known[file][1], file]) if known[file] and known[file][1]
+				known[file] = [hashes[file], results[i] ? segment : nil]
+			end
+
+			SongCollection.write_manifest(dir, manifest)
+			failures
+		end
+	end
+
+	# Merges segments that have tombstones or fewer than min_songs songs into one segment, leaving out the songs 
+	# with tombstones. Old segment files are deleted. Returns the number of merged segments.
+	def SongCollection.compact_segments(dir, min_songs = 1000)
+		with_lock(dir, File::LOCK_EX) do
+			manifest = read_manifest(dir)
+			dead = Hash.new(0)
+			manifest["tombstones"].each do |name, file| dead[name] += 1 end
+			merged = manifest["segments"].select { |name| dead[name] > 0 or manifest["sizes"][name] - dead[name] < min_songs }
+			return 0 if merged.empty? or (merged.size == 1 and dead[merged[0]] == 0)
+
+			tombstones = {}
+			manifest["tombstones"].each do |t| tombstones[t] = true end
+			songs = []
+			merged.each do |name|
+				File.open(dir + "/" + name, "rb") { |file| Marshal.load(file) }.each do |song| 
+					songs.push(song) if not tombstones[[name, song.filepath]]
+				end
+			end
+
+			# the merged segment replaces the first merged segment in collection order
+			index = manifest["segments"].index(merged[0])
+			manifest["segments"] -= merged
+			merged.each do |name| manifest["sizes"].delete(name) end
+			manifest["tombstones"].reject! { |name, file| merged.include?(name) }
+			if songs.size > 0
+				segment = format("segment-%06d.songs", manifest["next_segment"])
+				manifest["next_segment"] += 1
+				File.open(dir + "/" + segment, "wb") do |file| Marshal.dump(songs, file); file.fsync end
+				manifest["segments"].insert(index, segment)
+				manifest["sizes"][segment] = songs.size
+				songs.each do |song| manifest["files"][song.filepath][1] = segment if manifest["files"][song.filepath] end
+			end
+
+			write_manifest(dir, manifest)
+			merged.each do |name| File.delete(dir + "/" + name) end
+			merged.size
 		end
 	end
 
 
+	# Replaces chord data of all songs with the packed encoding (see Song). 
+	def pack_chords
+		@songs.each do |song| song.pack_chords end
+		@physical = index_duplicates(@songs)
+	end
+
 	# Creates a preprocessed data format that is used by monopoly algorithm for each song in this collection.
 	# Actual processing is done in Song class. 
 	def monopoly_preprocess
@@ -183,39 +393,119 @@ class SongCollection
 	end
 
 	# Converts MIDI files in a given directory to Song objects. 
-	# This method merely just calls MIDI conversion method SMF::Sequence class and a metadata conversion method. 
-	def convert_midifiles(path)
-		#if path then path = path.gsub(/\/\//, '/') end
+	# This method merely just calls MIDI conversion method and a metadata conversion method. 
+	# MIDI files are converted with the native converter (Song.from_midifile), or with SMF::Sequence class if native is false.
+	#
+	# Files are distributed to given number of worker processes. Converted songs are added to the collection 
+	# in sorted path order, so that the saved collection is identical regardless of the number of workers. 
+	# Prints a summary with conversion speed and failed files, and returns the failures as (path, message) pairs.
+	def convert_midifiles(path, native = true, workers = 1)
+		files = midifiles(path)
+		results = convert_files(files, native, workers)
+
+		# merge results in path order; only the new songs are indexed
+		added = results.select { |r| r.is_a?(Song) }
+		@songs.concat(added)
+		@physical = index_duplicates(@songs)
+		@text_index = CombinedTextIndex.new([@text_index, TextIndex.new(added)], @songs)
+		@maxpoly = @maxpoly_with_duplicates = @chords = @notes = @notes_with_duplicates = nil
+
+		failures = []
+		files.each_with_index do |file, i| failures.push([file, results[i]]) if results[i].is_a?(String) end
+		failures
+	end
 
+	# Converts given MIDI files with given number of worker processes and prints a summary. 
+	# Returns an array indexed like files: a Song, nil for a file without notes, or an error message.
+	def convert_files(files, native = true, workers = 1)
+		start = Time.now
+		if workers > 1 and files.size > 1 and Process.respond_to?(:fork)
+			results = convert_in_workers(files, native, workers)
+		else
+			results = files.map { |file| convert_midifile(file, native) }
+		end
+		elapsed = Time.now - start
+
+		converted = results.count { |r| r.is_a?(Song) }
+		failed = results.count { |r| r.is_a?(String) }
+		puts "Converted #{converted} of #{files.size} files in #{format('%.2f', elapsed)} s " + \
+			"(#{format('%.1f', files.size / [elapsed, 0.001].max)} files/s, #{workers} worker#{workers == 1 ? '' : 's'}), #{failed} failed."
+		files.each_with_index do |file, i| puts "Failed: #{file}: #{results[i]}" if results[i].is_a?(String) end
+		results
+	end
+
+	# Returns paths of MIDI files under a given path (a directory or a single file) in sorted order.
+	def midifiles(path)
 		if File.directory?(path) and not path =~ /\.$/
-			Dir.foreach(path) do |entry| convert_midifiles(path + '/' + entry) end
-			#puts "Conversion of directory #{path} finished."
-		elsif path =~ /\.mid$/
-			puts "Converting: #{path}"
-			begin
-				sq = SMF::Sequence.decodefile(path)
-				s = sq.convert
-				if not s then return nil end
-
-				s.filepath = path
-
-				# metadata handling specific to mutopia collection
-				if path =~ /mutopia/ then set_metadata(s)
-				else
-					s.title = path.gsub(/public\//, '')
-					s.midiurl = CGI.escape(s.filepath.gsub(/public\//, '')).gsub(/%2F/, "/")
-					s.scoreurl = s.composer = s.opus = s.date = s.style = s.instruments = ""
-				end
+			Dir.children(path).sort.map { |entry| midifiles(path + '/' + entry) }.flatten
+		elsif path =~ /\.mid$/ then [path]
+		else [] end
+	end
 
-				# add to collection
-				@songs.push(s)
+	# Converts a single MIDI file. Returns a Song, nil if the file contains no notes, or an error message.
+	def convert_midifile(path, native = true)
+		puts "Converting: #{path}"
+		begin
+			if native then s = MIR::Song.from_midifile(path)
+			else s = SMF::Sequence.decodefile(path).convert end
+			if not s then return nil end
+
+			s.filepath = path
+
+			# metadata handling specific to mutopia collection
+			if path =~ /mutopia/ then set_metadata(s)
+			else
+				s.title = path.gsub(/public\//, '')
+				s.midiurl = CGI.escape(s.filepath.gsub(/public\//, '')).gsub(/%2F/, "/")
+				s.scoreurl = s.composer = s.opus = s.date = s.style = s.instruments = ""
+			end
+			s
 
-			rescue => e	# SMF::Sequence::ReadError
-				puts "Error: skipping file #{path}.\e#{e.to_s}"
-				return nil
+		rescue => e	# SMF::Sequence::ReadError
+			puts "Error: skipping file #{path}. #{e.to_s}"
+			e.to_s
+		end
+	end
+
+	# Converts files in forked worker processes; worker w converts files w, w + workers, ... 
+	# Each worker sends (index, result) pairs through a pipe in Marshal format. 
+	# Returns results indexed like files; files of a crashed worker get an error message.
+	def convert_in_workers(files, native, workers)
+		results = Array.new(files.size)
+		done = Array.new(files.size, false)
+		workers = files.size if workers > files.size
+		children = (0...workers).map do |w|
+			reader, writer = IO.pipe
+			pid = fork do
+				reader.close
+				w.step(files.size - 1, workers) do |i|
+					Marshal.dump([i, convert_midifile(files[i], native)], writer)
+				end
+				writer.close
+				exit!(0)
 			end
+			writer.close
+			[pid, reader]
 		end
-		maxpoly
+
+		# read all pipes concurrently so that no worker blocks on a full pipe
+		children.map do |pid, reader|
+			Thread.new do
+				begin
+					loop do
+						i, result = Marshal.load(reader)
+						results[i] = result
+						done[i] = true
+					end
+				rescue EOFError, ArgumentError
+				end
+				reader.close
+				Process.wait(pid)
+			end
+		end.each(&:join)
+
+		done.each_with_index do |d, i| results[i] = "worker process failed" if not d end
+		results
 	end
 
 
@@ -232,14 +522,35 @@ class SongCollection
 		# select if search is from previous results or all songs in the collection
 		if matchlist then s = songs_from_matchlist(matchlist) else s = @songs end
 
-		method = "scan_#{algorithm}".to_sym
+		# with a text pattern, select the songs whose metadata matches it (see TextIndex)
+		if init_info.textpattern.size > 0 then
+			matching = @text_index.search(init_info.textpattern)
+			if matchlist then
+				matching = matching.to_h { |song| [song, true] }
+				s = s.select { |song| matching[song] }
+			else s = matching end
+		end
 
-		if init_info.textpattern.size == 0 then s.each do |song| song.send(method, init_info) end
-		else 
-			textpattern = Regexp.new(init_info.textpattern, Regexp::IGNORECASE)
-			s.each do |song|
-				song.send(method, init_info) if textpattern =~ song.title or textpattern =~ song.composer or textpattern =~ song.filepath or textpattern =~ song.opus or textpattern =~ song.style or textpattern =~ song.instruments or textpattern =~ song.date
+		method = "scan_#{algorithm}".to_sym
+		sections = AuxStore::ALGORITHM_SECTIONS[algorithm] || []
+
+		# duplicate songs are scanned only once; the matches are copied to the other songs with the same content.
+		# the search stops at its deadline, between songs or within a song whose scan function checks it.
+		matches = init_info.matches
+		found = {}.compare_by_identity
+		init_info.songs_total += s.size
+		s.each do |song|
+			break if init_info.expired?
+			physical = @physical[song] || song
+			if not (rows = found[physical])
+				first = matches.size
+				AuxStore.with_sections(physical, sections) { physical.send(method, init_info) }
+				break if init_info.timed_out
+				init_info.notes_searched += physical.num_notes
+				rows = found[physical] = matches.slice!(first..-1)
 			end
+			rows.each do |m| matches.push(m[0].equal?(song) ? m : [song].concat(m.drop(1))) end
+			init_info.songs_searched += 1
 		end
 
 		init_info.matches
@@ -266,7 +577,7 @@ class SongCollection
 		"<body><h4>Melody Search Database</h4>" <<
 		"<table>" <<
 		"<tr><th>Database</th><th>Songs</th><th>Chords</th><th>Notes</th><th>Max. Polyphony</th>" <<
-		"<th>Avg. Polyphony</th></tr><tr><td>#{@filepath}</td><td>#{songs}</td><td>#{chords}</td>" <<
+		"<th>Avg. Polyphony</th></tr><tr><td>#{@filepath}</td><td>#{songs} (#{distinct_songs} distinct)</td><td>#{chords}</td>" <<
 		"<td>#{notes[0]}/#{notes[1]}</td><td>#{maxpoly[0]}/#{maxpoly[1]}</td>" <<
 		"<td>#{"%4.2f" % avgpoly[0]}/#{"%4.2f" % avgpoly[1]}</td></tr></table>" <<
 		"For fields with two values, the first value is without duplicate notes (notes with same pitch in same chord), " <<
@@ -278,6 +589,20 @@ class SongCollection
 
 	private
 
+	# Returns a hash that maps each song having the same content hash (see Song#content_hash) as an earlier song to the 
+	# earliest such song. Searches scan only the earliest songs, and the others share their chord data.
+	def index_duplicates(songs)
+		physical = {}.compare_by_identity
+		first = {}
+		songs.each do |song|
+			p = (first[song.content_hash] ||= song)
+			next if p.equal?(song)
+			physical[song] = p
+			song.share_data(p)
+		end
+		physical
+	end
+
 	# Returns a list of songs included in a list of matches.
 	def songs_from_matchlist(matchlist)
 		songs = []
@@ -0,0 +1,124 @@
+# C-Brahms Engine for Musical Information Retrieval
+# University of Helsinki, Department of Computer Science
+#
+# Copyright Mika Turkia
+
+module MIR
+
+# Trigram index over the metadata of songs, used by SongCollection#search to find the songs matching a text pattern
+# without evaluating the pattern against every song.
+#
+# The index maps each trigram (three consecutive bytes) of the case folded metadata fields of a song to the
+# ids (indexes) of the songs containing it. Case folding is the one used by case-insensitive Regexps, so e.g. an "ss"
+# in a pattern finds also a "ß". A pattern that is an ASCII literal string, or literal strings separated by |,
+# is resolved to the songs that contain all trigrams of some alternative; other patterns select all songs.
+# The candidates are then checked with the pattern as a case-insensitive Regexp, so the result is the same as
+# matching every song. Songs with invalid metadata encoding are always candidates.
+class TextIndex
+
+	# Song fields that text patterns are matched against.
+	FIELDS = [:title, :composer, :filepath, :opus, :style, :instruments, :date]
+
+	# Songs of the index, in the order of their ids.
+	attr_reader :songs
+
+	# Builds an index of given songs. The index keeps a copy of the list, so songs added to it later are not indexed.
+	def initialize(songs)
+		@songs = songs.dup
+		@unindexed = []
+		postings = Hash.new { |h, k| h[k] = [] }
+		songs.each_with_index do |song, i|
+			# a newline separates the fields, so that no trigram of a literal spans two fields
+			text = FIELDS.collect { |field| song.send(field).to_s }.join("\n")
+			if not text.valid_encoding? then @unindexed.push(i); next end
+			TextIndex.trigrams(text.downcase(:fold)).uniq.each do |key| postings[key].push(i) end
+		end
+		# ids are pushed in increasing order, so the lists are sorted
+		@postings = {}
+		postings.each do |key, ids| @postings[key] = ids.pack("I*") end
+	end
+
+	# Returns the songs matching a text pattern (a Regexp source, matched ignoring case) in the order of their ids.
+	def search(pattern)
+		regexp = Regexp.new(pattern, Regexp::IGNORECASE)
+		candidates(pattern).collect { |i| @songs[i] }.select do |song|
+			FIELDS.any? { |field| regexp =~ song.send(field) }
+		end
+	end
+
+	# Returns the sorted ids of the songs that may match a text pattern.
+	def candidates(pattern)
+		alternatives = TextIndex.literals(pattern)
+		return (0...@songs.size).to_a if not alternatives or alternatives.any? { |literal| literal.size < 3 }
+		ids = @unindexed.dup
+		alternatives.each do |literal| ids.concat(lookup(literal.downcase(:fold))) end
+		ids.sort!
+		ids.uniq!
+		ids
+	end
+
+	# Returns the alternatives of a pattern consisting of ASCII literal strings separated by |, with backslash escapes of
+	# punctuation resolved, or nil for other patterns.
+	def TextIndex.literals(pattern)
+		return nil if not pattern.ascii_only?
+		alternatives = [""]
+		escaped = false
+		pattern.each_char do |c|
+			if escaped then
+				return nil if c =~ /[[:alnum:]\s]/
+				alternatives[-1] << c
+				escaped = false
+			elsif c == "\\" then escaped = true
+			elsif c == "|" then alternatives.push("")
+			elsif "^$.?*+()[]{}\n".include?(c) then return nil
+			else alternatives[-1] << c end
+		end
+		escaped ? nil : alternatives
+	end
+
+	# Returns the trigrams of the bytes of a string as integer keys.
+	def TextIndex.trigrams(text)
+		b = text.bytes
+		(0...b.size - 2).collect { |j| (b[j] << 16) | (b[j + 1] << 8) | b[j + 2] }
+	end
+
+	private
+
+	# Returns the ids of the songs containing all trigrams of a case folded literal.
+	# The lists are intersected from the shortest one.
+	def lookup(literal)
+		lists = TextIndex.trigrams(literal).uniq.collect { |key| @postings[key] or return [] }
+		lists.sort_by!(&:bytesize)
+		ids = lists[0].unpack("I*")
+		lists.drop(1).each do |list|
+			break if ids.empty?
+			ids &= list.unpack("I*")
+		end
+		ids
+	end
+end
+
+# Index over the songs of several TextIndexes, e.g. of the segments of a segmented collection, leaving out songs that 
+# have been removed. The postings of the indexes are not copied or rebuilt: candidates are looked up in each index 
+# and renumbered, so an index of a changed collection is built in time linear in the number of its songs, reusing 
+# the indexes of unchanged parts.
+class CombinedTextIndex < TextIndex
+
+	# Combines given indexes for songs, which are the songs of the indexes in the same order, possibly with some left out.
+	def initialize(indexes, songs)
+		@songs = songs.dup
+		j = 0
+		# for each index, the id in this index of each song of that index, or nil for a song left out
+		@parts = indexes.collect do |index|
+			[index, index.songs.collect { |song| if j < songs.size and songs[j].equal?(song) then (j += 1) - 1 end }]
+		end
+		raise ArgumentError, "songs are not those of the indexes" if j < songs.size
+	end
+
+	# Returns the sorted ids of the songs that may match a text pattern.
+	def candidates(pattern)
+		@parts.flat_map { |index, ids| index.candidates(pattern).filter_map { |i| ids[i] } }
+	end
+end
+
+end	# module